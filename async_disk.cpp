@@ -0,0 +1,441 @@
+#include "async_disk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+struct async_disk::request {
+    bool          write;
+    unsigned int  block;
+    unsigned int  size;             // bytes in a block of this disk
+    void         *buf;
+    callback      done;
+};
+
+// An engine carries requests to the disk and calls their callbacks
+class async_disk::engine {
+public:
+    virtual ~engine() = default;
+
+    // REQUIRES: req was allocated with new
+    // EFFECTS: starts req, and deletes it after calling req->done
+    virtual void submit(request *req) = 0;
+
+    virtual const char *name() const = 0;
+};
+
+namespace {
+
+// Finish one request: check the transfer and call back the submitter
+void complete(async_disk::request *req, ssize_t result)
+{
+    assert(result == ssize_t(req->size));
+    if (req->done) {
+	req->done();
+    }
+    delete req;
+}
+
+// The portable engine: worker threads doing blocking pread/pwrite
+class thread_engine : public async_disk::engine {
+    int                                  fd;
+    std::mutex                           m;
+    std::condition_variable              cv;
+    std::deque<async_disk::request *>    queue;
+    bool                                 stopping = false;
+    std::vector<std::thread>             workers;
+
+    void work();
+
+public:
+    thread_engine(int fd, unsigned int nthreads);
+    ~thread_engine();
+
+    void submit(async_disk::request *req) override;
+    const char *name() const override { return "threads"; }
+};
+
+thread_engine::thread_engine(int fd_, unsigned int nthreads)
+    : fd(fd_)
+{
+    for (unsigned int i = 0; i < nthreads; i++) {
+	workers.emplace_back(&thread_engine::work, this);
+    }
+}
+
+thread_engine::~thread_engine()
+{
+    {
+	std::lock_guard<std::mutex> lock(m);
+	stopping = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers) {
+	worker.join();
+    }
+}
+
+void thread_engine::submit(async_disk::request *req)
+{
+    {
+	std::lock_guard<std::mutex> lock(m);
+	queue.push_back(req);
+    }
+    cv.notify_one();
+}
+
+void thread_engine::work()
+{
+    std::unique_lock<std::mutex> lock(m);
+
+    // Queued requests are drained before the workers exit
+    while (true) {
+	while (queue.empty() && !stopping) {
+	    cv.wait(lock);
+	}
+	if (queue.empty()) {
+	    return;
+	}
+
+	async_disk::request *req = queue.front();
+	queue.pop_front();
+	lock.unlock();
+
+	off_t   offset = off_t(req->block) * req->size;
+	ssize_t n = req->write ? pwrite(fd, req->buf, req->size, offset)
+			       : pread(fd, req->buf, req->size, offset);
+	complete(req, n);
+
+	lock.lock();
+    }
+}
+
+#ifdef __linux__
+
+// The Linux engine: an io_uring set up with raw system calls (no
+// liburing needed), drained by a single completion thread.
+class uring_engine : public async_disk::engine {
+    int           fd;
+    int           ring_fd = -1;
+    unsigned int  depth;
+
+    // Submission queue
+    void          *sq_ring = MAP_FAILED;
+    size_t         sq_ring_size = 0;
+    unsigned      *sq_tail, *sq_mask, *sq_array;
+    io_uring_sqe  *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t         sqes_size = 0;
+
+    // Completion queue (may share the submission queue mapping)
+    void          *cq_ring = MAP_FAILED;
+    size_t         cq_ring_size = 0;
+    unsigned      *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe  *cqes;
+
+    // Submitters wait here when depth requests are in flight
+    std::mutex               m;
+    std::condition_variable  cv;
+    unsigned int             inflight = 0;
+
+    std::thread  completer;
+
+    int enter(unsigned int to_submit, unsigned int min_complete,
+	      unsigned int flags);
+    void push(uint8_t opcode, async_disk::request *req);
+    void reap();
+
+public:
+    uring_engine(int fd, unsigned int depth);
+    ~uring_engine();
+
+    // EFFECTS: returns whether the kernel let us set up the ring
+    bool ok() const { return sqes != MAP_FAILED; }
+
+    void submit(async_disk::request *req) override;
+    const char *name() const override { return "io_uring"; }
+};
+
+uring_engine::uring_engine(int fd_, unsigned int depth_)
+    : fd(fd_), depth(depth_)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ring_fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (ring_fd < 0) {
+	return;
+    }
+
+    // Never have more requests in flight than the completion queue holds
+    depth = std::min(depth, p.cq_entries);
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+	return;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	cq_ring = sq_ring;
+    } else {
+	cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	if (cq_ring == MAP_FAILED) {
+	    return;
+	}
+    }
+
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) {
+	return;
+    }
+
+    char *sq = static_cast<char *>(sq_ring);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+    char *cq = static_cast<char *>(cq_ring);
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    // Setting sqes last marks the ring as usable
+    sqes = static_cast<io_uring_sqe *>(s);
+    completer = std::thread(&uring_engine::reap, this);
+}
+
+uring_engine::~uring_engine()
+{
+    if (completer.joinable()) {
+	// A NOP with no request tells the completion thread to exit.  It
+	// is queued behind everything already submitted, but io_uring may
+	// complete it first, so wait for the ring to drain.
+	{
+	    std::unique_lock<std::mutex> lock(m);
+	    while (inflight) {
+		cv.wait(lock);
+	    }
+	}
+	push(IORING_OP_NOP, nullptr);
+	completer.join();
+    }
+
+    if (sqes != MAP_FAILED) {
+	munmap(sqes, sqes_size);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+	munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != MAP_FAILED) {
+	munmap(sq_ring, sq_ring_size);
+    }
+    if (ring_fd >= 0) {
+	close(ring_fd);
+    }
+}
+
+int uring_engine::enter(unsigned int to_submit, unsigned int min_complete,
+			unsigned int flags)
+{
+    int n;
+    do {
+	n = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+		    flags, nullptr, 0);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+void uring_engine::push(uint8_t opcode, async_disk::request *req)
+// EFFECTS: queues one submission queue entry and submits it
+{
+    std::unique_lock<std::mutex> lock(m);
+
+    while (req && inflight >= depth) {
+	cv.wait(lock);
+    }
+    if (req) {
+	inflight++;
+    }
+
+    // Only this function (under m) writes the tail; the kernel consumes
+    // the entry during io_uring_enter below, so the slot is free again
+    // by the time the next submitter gets here.
+    unsigned int tail = *sq_tail;
+    unsigned int index = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = reinterpret_cast<uint64_t>(req);
+    if (req) {
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(req->buf);
+	sqe->len = req->size;
+	sqe->off = uint64_t(req->block) * req->size;
+    }
+
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int n = enter(1, 0, 0);
+    assert(n == 1);
+}
+
+void uring_engine::submit(async_disk::request *req)
+{
+    push(req->write ? IORING_OP_WRITE : IORING_OP_READ, req);
+}
+
+void uring_engine::reap()
+// EFFECTS: runs on the completion thread until it sees the NOP queued
+//          by the destructor
+{
+    bool stopping = false;
+    std::vector<std::pair<async_disk::request *, int>> done;
+
+    while (!stopping) {
+	enter(0, 1, IORING_ENTER_GETEVENTS);
+
+	unsigned int head = *cq_head;
+	unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+	done.clear();
+	for (; head != tail; head++) {
+	    io_uring_cqe *cqe = &cqes[head & *cq_mask];
+	    auto *req = reinterpret_cast<async_disk::request *>(
+		cqe->user_data);
+
+	    if (req) {
+		done.emplace_back(req, cqe->res);
+	    } else {
+		stopping = true;
+	    }
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+	// Give back the slots before running the callbacks, which may
+	// submit more requests and would otherwise wait for themselves
+	if (!done.empty()) {
+	    std::lock_guard<std::mutex> lock(m);
+	    inflight -= done.size();
+	    cv.notify_all();
+	}
+	for (auto &d : done) {
+	    complete(d.first, d.second);
+	}
+    }
+}
+
+#endif // __linux__
+
+} // namespace
+
+async_disk::async_disk(const std::string &path, unsigned int depth)
+{
+    assert(depth > 0);
+
+    fd = open(path.c_str(), O_RDWR);
+    assert(fd >= 0);
+
+    geom = fs_geometry::probe(fd);
+
+#ifdef __linux__
+    std::unique_ptr<uring_engine> uring(new uring_engine(fd, depth));
+    if (uring->ok()) {
+	impl = std::move(uring);
+	return;
+    }
+#endif
+
+    // Enough threads to keep a reasonable number of requests in flight
+    impl.reset(new thread_engine(fd, std::min(depth, 16u)));
+}
+
+async_disk::~async_disk()
+{
+    impl.reset();
+    close(fd);
+}
+
+fs_geometry async_disk::geometry() const
+{
+    return geom;
+}
+
+void async_disk::submit(bool write, unsigned int block, void *buf,
+			callback done)
+{
+    assert(block < geom.disk_blocks);
+    impl->submit(new request{write, block, geom.block_size, buf,
+			     std::move(done)});
+}
+
+void async_disk::submit_read(unsigned int block, void *buf, callback done)
+{
+    submit(false, block, buf, std::move(done));
+}
+
+void async_disk::submit_write(unsigned int block, const void *buf,
+			      callback done)
+{
+    submit(true, block, const_cast<void *>(buf), std::move(done));
+}
+
+std::future<void> async_disk::submit_read(unsigned int block, void *buf)
+{
+    // std::function must be copyable, so the promise is shared
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> result = done->get_future();
+
+    submit_read(block, buf, [done] { done->set_value(); });
+    return result;
+}
+
+std::future<void> async_disk::submit_write(unsigned int block,
+					   const void *buf)
+{
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> result = done->get_future();
+
+    submit_write(block, buf, [done] { done->set_value(); });
+    return result;
+}
+
+void async_disk::readblock(unsigned int block, void *buf)
+{
+    submit_read(block, buf).get();
+}
+
+void async_disk::writeblock(unsigned int block, const void *buf)
+{
+    submit_write(block, buf).get();
+}
+
+const char *async_disk::backend() const
+{
+    return impl->name();
+}
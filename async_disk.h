@@ -0,0 +1,71 @@
+/*
+ * async_disk.h
+ *
+ * An asynchronous interface to the disk image.  Requests are submitted
+ * without waiting for the device; each one either returns a future or
+ * runs a callback on a completion thread once the transfer is done.
+ *
+ * On Linux requests go through an io_uring.  Elsewhere (e.g. on macOS),
+ * or when the kernel refuses to set up a ring, a pool of threads issues
+ * blocking pread/pwrite calls instead.
+ *
+ * The blocking readblock/writeblock of block_device are thin wrappers
+ * that submit a request and wait for it.  As with the synchronous
+ * interface, concurrent requests for the same block complete in no
+ * particular order.
+ */
+
+#ifndef _ASYNC_DISK_H_
+#define _ASYNC_DISK_H_
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "block_device.h"
+
+class async_disk : public block_device {
+public:
+    // Runs on a completion thread, so it must not block for long.  It
+    // may submit more requests.
+    using callback = std::function<void()>;
+
+    // REQUIRES: path names a disk image as for striped_disk, depth > 0
+    // EFFECTS: opens the disk image, allowing up to depth requests in
+    //          flight at once.  Asserts on failure.
+    explicit async_disk(const std::string &path = fs_disk_path(),
+			unsigned int depth = 64);
+
+    // EFFECTS: waits for all outstanding requests to complete
+    ~async_disk();
+
+    fs_geometry geometry() const override;
+
+    // REQUIRES: buf stays valid until the request completes
+    // EFFECTS: queues a transfer of block to/from buf.  May block while
+    //          depth requests are already in flight.
+    std::future<void> submit_read(unsigned int block, void *buf);
+    std::future<void> submit_write(unsigned int block, const void *buf);
+    void submit_read(unsigned int block, void *buf, callback done);
+    void submit_write(unsigned int block, const void *buf, callback done);
+
+    void readblock(unsigned int block, void *buf) override;
+    void writeblock(unsigned int block, const void *buf) override;
+
+    // EFFECTS: returns "io_uring" or "threads"
+    const char *backend() const;
+
+    // Implementation details, defined in async_disk.cpp
+    struct request;
+    class engine;
+
+private:
+    int fd;
+    fs_geometry geom;
+    std::unique_ptr<engine> impl;
+
+    void submit(bool write, unsigned int block, void *buf, callback done);
+};
+
+#endif /* _ASYNC_DISK_H_ */
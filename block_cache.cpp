@@ -0,0 +1,196 @@
+#include "block_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "fs_stats.h"
+
+double block_cache::stats_t::hit_rate() const
+{
+    uint64_t total = hits + misses;
+    return total ? static_cast<double>(hits) / total : 0.0;
+}
+
+block_cache::block_cache(block_device &disk_, unsigned int capacity,
+			 unsigned int nshards_)
+    : disk(disk_), geom(disk_.geometry()),
+      nshards(std::max(1u, std::min(nshards_, capacity)))
+{
+    assert(capacity > 0 && nshards_ > 0);
+    assert(geom.block_size == FS_BLOCKSIZE);
+
+    shards.reset(new shard[nshards]);
+
+    // Hand out the frames as evenly as possible
+    for (unsigned int i = 0; i < nshards; i++) {
+	unsigned int n = capacity / nshards + (i < capacity % nshards);
+	shards[i].frames.resize(n);
+	shards[i].index.reserve(n);
+    }
+}
+
+block_cache::~block_cache()
+{
+    flush();
+}
+
+block_cache::shard &block_cache::shard_for(unsigned int block)
+{
+    // Neighbouring blocks land in different shards, so a sequential scan
+    // does not pile up on one lock.
+    return shards[block % nshards];
+}
+
+block_cache::frame *block_cache::lookup(shard &s, unsigned int block)
+// REQUIRES: s.m is held
+//
+// EFFECTS: returns the frame caching block, or nullptr if it is not
+//          cached.  Marks the frame as recently used.
+{
+    auto it = s.index.find(block);
+    if (it == s.index.end()) {
+	s.stats.misses++;
+	FS_COUNT(count_cache_misses);
+	return nullptr;
+    }
+
+    s.stats.hits++;
+    FS_COUNT(count_cache_hits);
+    frame &f = s.frames[it->second];
+    f.referenced = true;
+    return &f;
+}
+
+block_cache::frame &block_cache::allocate(shard &s, unsigned int block)
+// REQUIRES: s.m is held, block is not cached in s
+//
+// MODIFIES: s
+//
+// EFFECTS: picks a frame with the CLOCK algorithm, writes it back if it
+//          is dirty, and assigns it to block.  The contents of the
+//          returned frame are undefined.
+{
+    // Advance the hand, giving each referenced frame a second chance.
+    // This terminates within two sweeps.
+    while (true) {
+	frame &f = s.frames[s.hand];
+	s.hand = (s.hand + 1) % s.frames.size();
+
+	if (f.valid && f.referenced) {
+	    f.referenced = false;
+	    continue;
+	}
+
+	if (f.valid) {
+	    writeback(s, f);
+	    s.index.erase(f.block);
+	    s.stats.evictions++;
+	}
+
+	f.block = block;
+	f.valid = true;
+	f.dirty = false;
+	f.referenced = true;
+	s.index[block] = &f - s.frames.data();
+	return f;
+    }
+}
+
+void block_cache::writeback(shard &s, frame &f)
+// REQUIRES: s.m is held, f belongs to s
+//
+// EFFECTS: writes f to the disk if it is dirty
+{
+    if (f.valid && f.dirty) {
+	disk.writeblock(f.block, f.data);
+	f.dirty = false;
+	s.stats.writebacks++;
+    }
+}
+
+void block_cache::readblock(unsigned int block, void *buf)
+{
+    assert(block < geom.disk_blocks);
+
+    shard &s = shard_for(block);
+    std::lock_guard<shard_mutex> lock(s.m);
+
+    frame *f = lookup(s, block);
+    if (!f) {
+	f = &allocate(s, block);
+	disk.readblock(block, f->data);
+    }
+
+    memcpy(buf, f->data, FS_BLOCKSIZE);
+}
+
+void block_cache::writeblock(unsigned int block, const void *buf)
+{
+    assert(block < geom.disk_blocks);
+
+    shard &s = shard_for(block);
+    std::lock_guard<shard_mutex> lock(s.m);
+
+    // A write replaces the whole block, so a miss does not need to read
+    // the old contents from the disk.
+    frame *f = lookup(s, block);
+    if (!f) {
+	f = &allocate(s, block);
+    }
+
+    memcpy(f->data, buf, FS_BLOCKSIZE);
+    f->dirty = true;
+}
+
+void block_cache::flush(unsigned int block)
+{
+    shard &s = shard_for(block);
+    std::lock_guard<shard_mutex> lock(s.m);
+
+    auto it = s.index.find(block);
+    if (it != s.index.end()) {
+	writeback(s, s.frames[it->second]);
+    }
+}
+
+void block_cache::flush()
+{
+    for (unsigned int i = 0; i < nshards; i++) {
+	shard &s = shards[i];
+	std::lock_guard<shard_mutex> lock(s.m);
+
+	for (frame &f : s.frames) {
+	    writeback(s, f);
+	}
+    }
+}
+
+fs_geometry block_cache::geometry() const
+{
+    return geom;
+}
+
+unsigned int block_cache::capacity() const
+{
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < nshards; i++) {
+	total += shards[i].frames.size();
+    }
+    return total;
+}
+
+block_cache::stats_t block_cache::stats() const
+{
+    stats_t total;
+    for (unsigned int i = 0; i < nshards; i++) {
+	shard &s = shards[i];
+	std::lock_guard<shard_mutex> lock(s.m);
+
+	total.hits += s.stats.hits;
+	total.misses += s.stats.misses;
+	total.evictions += s.stats.evictions;
+	total.writebacks += s.stats.writebacks;
+    }
+    return total;
+}
@@ -0,0 +1,105 @@
+/*
+ * block_cache.h
+ *
+ * A thread-safe, sharded, write-back cache of disk blocks that sits in
+ * front of another block_device (usually the libfs_server.o disk).
+ *
+ * Blocks are spread over the shards by block number; each shard has
+ * its own lock and a fixed number of FS_BLOCKSIZE frames that are
+ * recycled with the CLOCK (second chance) algorithm.  The shard locks
+ * record their acquires and waits in fs_stats.
+ *
+ * Write ordering: writeblock only updates the cache.  Dirty blocks may
+ * reach the disk in any order (on eviction or on a flush) until the
+ * next flush point.  To keep the ordering rules of the file system
+ * (e.g. a file inode and its direntry block must be on disk before the
+ * inode that points to them) callers must flush after writing the
+ * blocks that have to be durable first:
+ *
+ *     cache.writeblock(1, &file_inode);
+ *     cache.flush();                      // inode before direntry
+ *     cache.writeblock(2, root_dirblock);
+ *     cache.flush();                      // direntry before root inode
+ *     cache.writeblock(0, &root_inode);
+ */
+
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "block_device.h"
+#include "instrumented_mutex.h"
+
+class block_cache : public block_device {
+public:
+    struct stats_t {
+	uint64_t hits = 0;             // reads and writes found in cache
+	uint64_t misses = 0;           // reads and writes that were not
+	uint64_t evictions = 0;        // frames recycled for another block
+	uint64_t writebacks = 0;       // dirty blocks written to the disk
+
+	double hit_rate() const;
+    };
+
+    // REQUIRES: capacity > 0, nshards > 0, disk has FS_BLOCKSIZE
+    //           byte blocks
+    // EFFECTS: creates a cache of capacity blocks in front of disk.
+    //          If capacity < nshards, fewer shards are used.
+    block_cache(block_device &disk, unsigned int capacity,
+		unsigned int nshards = 16);
+
+    // EFFECTS: flushes all dirty blocks
+    ~block_cache();
+
+    void readblock(unsigned int block, void *buf) override;
+    void writeblock(unsigned int block, const void *buf) override;
+
+    fs_geometry geometry() const override;
+
+    // EFFECTS: writes block to the disk if it is cached and dirty
+    void flush(unsigned int block);
+
+    // EFFECTS: writes every dirty block to the disk.  All writeblock
+    //          calls that returned before flush was called are on the
+    //          disk when it returns.
+    void flush();
+
+    unsigned int capacity() const;
+    stats_t stats() const;
+
+private:
+    struct frame {
+	unsigned int block = 0;
+	bool valid = false;
+	bool dirty = false;
+	bool referenced = false;
+	char data[FS_BLOCKSIZE];
+    };
+
+    using shard_mutex = instrumented_mutex<stats_instrumentation>;
+
+    struct shard {
+	shard_mutex m;
+	std::vector<frame> frames;
+	std::unordered_map<unsigned int, unsigned int> index;  // block->frame
+	unsigned int hand = 0;
+	stats_t stats;
+    };
+
+    block_device &disk;
+    const fs_geometry geom;
+    const unsigned int nshards;
+    std::unique_ptr<shard[]> shards;
+
+    shard &shard_for(unsigned int block);
+    frame *lookup(shard &s, unsigned int block);
+    frame &allocate(shard &s, unsigned int block);
+    void writeback(shard &s, frame &f);
+};
+
+#endif /* _BLOCK_CACHE_H_ */
@@ -0,0 +1,95 @@
+/*
+ * block_device.h
+ *
+ * Abstract interface to a disk of geometry().disk_blocks blocks of
+ * geometry().block_size bytes each: FS_DISKSIZE blocks of FS_BLOCKSIZE
+ * bytes, unless the image says otherwise (see superblock.h).  Caches
+ * and alternate disk backends are written against this interface so
+ * they can be stacked on top of one another.
+ */
+
+#ifndef _BLOCK_DEVICE_H_
+#define _BLOCK_DEVICE_H_
+
+#include <cstdlib>
+#include <string>
+
+#include "fs_server.h"
+#include "fs_stats.h"
+#include "superblock.h"
+
+class block_device {
+public:
+    virtual ~block_device() = default;
+
+    // EFFECTS: returns the geometry of the disk.  The default is the
+    //          compiled-in one.
+    virtual fs_geometry geometry() const
+    {
+	return fs_geometry();
+    }
+
+    // Both calls must be thread safe, with the same semantics as
+    // disk_readblock and disk_writeblock in fs_server.h.  buf holds
+    // geometry().block_size bytes.
+    virtual void readblock(unsigned int block, void *buf) = 0;
+    virtual void writeblock(unsigned int block, const void *buf) = 0;
+
+    // Vectored versions: transfer blocks[i] to/from bufs[i] for each
+    // 0 <= i < n, returning once all of them are complete.  A block may
+    // appear more than once; for writes the last copy wins.  Backends
+    // that can coalesce adjacent blocks override these; the defaults
+    // just loop.
+    virtual void readblocks(const unsigned int *blocks, void *const *bufs,
+			    unsigned int n)
+    {
+	for (unsigned int i = 0; i < n; i++) {
+	    readblock(blocks[i], bufs[i]);
+	}
+    }
+
+    virtual void writeblocks(const unsigned int *blocks,
+			     const void *const *bufs, unsigned int n)
+    {
+	for (unsigned int i = 0; i < n; i++) {
+	    writeblock(blocks[i], bufs[i]);
+	}
+    }
+};
+
+/*
+ * fs_server_device
+ *
+ * The disk provided by libfs_server.o (disk_readblock/disk_writeblock).
+ * The disk times include waiting for its internal mutex.
+ */
+class fs_server_device : public block_device {
+public:
+    void readblock(unsigned int block, void *buf) override
+    {
+	FS_TIME(time_disk_read);
+	FS_COUNT(count_disk_blocks_read);
+	disk_readblock(block, buf);
+    }
+
+    void writeblock(unsigned int block, const void *buf) override
+    {
+	FS_TIME(time_disk_write);
+	FS_COUNT(count_disk_blocks_written);
+	disk_writeblock(block, buf);
+    }
+};
+
+/*
+ * fs_disk_path
+ *
+ * Name of the disk file libfs_server.o uses (/tmp/fs_tmp.$USER.disk), for
+ * backends that open the disk image themselves.
+ */
+inline std::string fs_disk_path()
+{
+    const char *user = getenv("USER");
+    return std::string("/tmp/fs_tmp.") + (user ? user : "undefined") + ".disk";
+}
+
+#endif /* _BLOCK_DEVICE_H_ */
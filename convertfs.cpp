@@ -0,0 +1,327 @@
+#include "extent_inode.h"
+#include "free_map.h"
+#include "fs_tool.h"
+#include "inline_inode.h"
+#include "packed_dir.h"
+#include "striped_disk.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Convert every inode of the file system disk to the extent format of
+// extent_inode.h, or with -r back to plain fs_inodes, in place.  Data
+// and direntry blocks stay where they are; only inode blocks are
+// rewritten, and indirect blocks are allocated or freed as needed.  A
+// file of more than FS_MAXFILEBLOCKS blocks cannot be converted back
+// and is left as it is.
+//
+// With -i, every plain one-block file whose data fits in its inode is
+// made an inline inode (see inline_inode.h) and its data block freed;
+// -r turns inline inodes back into plain ones.  With -p, every plain
+// directory is rewritten in the packed format of packed_dir.h, in as
+// few blocks as its names fit in; -r unpacks them again.  Extent
+// conversion leaves inline inodes and packed directories alone.
+//
+//     usage: convertfs [-r | -i | -p]
+
+struct found {
+    unsigned int  block;
+    fs_inode      inode;
+    inode_map     map;
+};
+
+// The entries of a directory, and where each is to be written
+struct dir_entries {
+    std::vector<fs_direntry>  entries;
+    std::vector<unsigned int> blocks;      // new blocks, in order
+};
+
+bool take_blocks(free_map &free_blocks, unsigned int n, dir_entries &dir)
+// EFFECTS: allocates n blocks into dir.blocks, or none if the disk is
+//          too full.  Returns whether it did.
+{
+    while (dir.blocks.size() < n) {
+	unsigned int b = free_blocks.allocate();
+	if (!b) {
+	    for (unsigned int t : dir.blocks) {
+		free_blocks.release(t);
+	    }
+	    dir.blocks.clear();
+	    return false;
+	}
+	dir.blocks.push_back(b);
+    }
+    return true;
+}
+
+void replace_blocks(striped_disk &disk, free_map &free_blocks, found &f,
+		    char type, const dir_entries &dir)
+// EFFECTS: points the directory inode of f at dir.blocks (which are
+//          already written) and frees its old blocks
+{
+    fs_inode updated;
+    memset(&updated, 0, sizeof(updated));
+    updated.type = type;
+    strcpy(updated.owner, f.inode.owner);
+    updated.size = dir.blocks.size();
+    std::copy(dir.blocks.begin(), dir.blocks.end(), updated.blocks);
+    disk.writeblock(f.block, &updated);
+
+    // Only once nothing refers to them
+    for (uint32_t b : f.map.blocks()) {
+	free_blocks.release(b);
+    }
+}
+
+bool pack(striped_disk &disk, free_map &free_blocks, found &f)
+// REQUIRES: f is a plain directory
+// EFFECTS: rewrites f as a packed directory.  Returns false if it is
+//          left as it was.
+{
+    dir_entries dir;
+    std::vector<packed_dirblock> packed(1);
+
+    for (uint32_t b : f.map.blocks()) {
+	fs_direntry entries[FS_DIRENTRIES];
+	disk.readblock(b, entries);
+	for (const fs_direntry &d : entries) {
+	    if (!d.inode_block) {
+		continue;
+	    }
+	    if (!packed.back().fits(d.name)) {
+		packed.emplace_back();
+	    }
+	    packed.back().insert(d.name, d.inode_block);
+	}
+    }
+    if (!packed.back().count()) {
+	packed.pop_back();
+    }
+
+    // Eight names of the longest length take more than one packed block
+    if (packed.size() > FS_MAXFILEBLOCKS ||
+	!take_blocks(free_blocks, packed.size(), dir)) {
+	return false;
+    }
+    for (unsigned int i = 0; i < packed.size(); i++) {
+	disk.writeblock(dir.blocks[i], &packed[i]);
+    }
+    replace_blocks(disk, free_blocks, f, FS_PACKED_DIRECTORY, dir);
+    return true;
+}
+
+bool unpack(striped_disk &disk, free_map &free_blocks, found &f)
+// REQUIRES: f is a packed directory
+// EFFECTS: rewrites f as a plain directory.  Returns false if it is
+//          left as it was.
+{
+    dir_entries dir;
+
+    for (uint32_t b : f.map.blocks()) {
+	packed_dirblock packed;
+	disk.readblock(b, &packed);
+
+	std::size_t n = dir.entries.size();
+	dir.entries.resize(n + packed.count());
+	packed.unpack(&dir.entries[n]);
+    }
+
+    unsigned int n = (dir.entries.size() + FS_DIRENTRIES - 1)
+		     / FS_DIRENTRIES;
+    if (n > FS_MAXFILEBLOCKS || !take_blocks(free_blocks, n, dir)) {
+	return false;
+    }
+
+    dir.entries.resize(n * FS_DIRENTRIES);
+    for (unsigned int i = 0; i < n; i++) {
+	disk.writeblock(dir.blocks[i], &dir.entries[i * FS_DIRENTRIES]);
+    }
+    replace_blocks(disk, free_blocks, f, 'd', dir);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool reverse = argc > 1 && !strcmp(argv[1], "-r");
+    bool inline_small = argc > 1 && !strcmp(argv[1], "-i");
+    bool pack_dirs = argc > 1 && !strcmp(argv[1], "-p");
+    if (argc > 2 || (argc == 2 && !reverse && !inline_small && !pack_dirs)) {
+	std::cerr << "usage: " << argv[0] << " [-r | -i | -p]\n";
+	return 1;
+    }
+
+    striped_disk disk;
+    if (!fs_blocksize_disk(disk, argv[0])) {
+	return 1;
+    }
+    free_map     free_blocks(disk.geometry().disk_blocks);
+
+    free_blocks.build(disk);
+
+    // Collect the inodes first, so none is rewritten under the walk
+    class collector : public tree_walk::visitor {
+	std::mutex          m;
+
+    public:
+	std::vector<found>  inodes;
+
+	void inode(const std::string &, unsigned int block,
+		   const fs_inode &inode, const inode_map &map) override
+	{
+	    std::lock_guard<std::mutex> lock(m);
+	    inodes.push_back({block, inode, map});
+	}
+    };
+
+    collector  all;
+    tree_walk  walk(disk, 4);
+    walk.run(all);
+
+    unsigned int converted = 0, skipped = 0, extents = 0, indirect = 0;
+    unsigned int inlined = 0, dirs = 0, dir_blocks = 0, packed_blocks = 0;
+
+    for (found &f : all.inodes) {
+	char kind = inode_kind(f.inode);
+
+	if (pack_dirs || is_packed_directory(f.inode)) {
+	    bool plain = f.inode.type == 'd';
+	    if (!(pack_dirs ? plain : reverse)) {
+		continue;
+	    }
+
+	    if (!(pack_dirs ? pack : unpack)(disk, free_blocks, f)) {
+		std::cerr << "disk full or directory too large; inode block "
+			  << f.block << " left as it is\n";
+		skipped++;
+		continue;
+	    }
+
+	    fs_inode updated;
+	    disk.readblock(f.block, &updated);
+	    dirs++;
+	    (plain ? dir_blocks : packed_blocks) += f.inode.size;
+	    (plain ? packed_blocks : dir_blocks) += updated.size;
+	    converted++;
+	    continue;
+	}
+
+	if (inline_small) {
+	    if (f.inode.type != 'f' || f.inode.size != 1) {
+		continue;
+	    }
+
+	    char data[FS_BLOCKSIZE];
+	    unsigned int data_block = f.inode.blocks[0];
+	    disk.readblock(data_block, data);
+	    if (!fits_inline(data)) {
+		continue;
+	    }
+
+	    make_inline(f.inode, data);
+	    disk.writeblock(f.block, &f.inode);
+	    free_blocks.release(data_block);
+	    inlined++;
+	    continue;
+	}
+
+	if (is_inline_inode(f.inode)) {
+	    if (!reverse) {
+		continue;
+	    }
+
+	    unsigned int data_block = free_blocks.allocate();
+	    if (!data_block) {
+		std::cerr << "disk full; inode block " << f.block
+			  << " left inline\n";
+		skipped++;
+		continue;
+	    }
+
+	    // The data block before the inode that points to it
+	    char data[FS_BLOCKSIZE];
+	    make_plain(f.inode, data_block, data);
+	    disk.writeblock(data_block, data);
+	    disk.writeblock(f.block, &f.inode);
+	    inlined++;
+	    converted++;
+	    continue;
+	}
+
+	if (is_extent_inode(f.inode) != reverse) {
+	    continue;
+	}
+
+	if (!reverse) {
+	    std::vector<uint32_t> used;
+	    if (!write_extent_inode(
+		    disk, f.block, kind, f.inode.owner, f.map,
+		    [&] { return free_blocks.allocate(); },
+		    [&](unsigned int b) { free_blocks.release(b); }, &used)) {
+		std::cerr << "disk full; inode block " << f.block
+			  << " left as it is\n";
+		skipped++;
+		continue;
+	    }
+	    extents += f.map.extents.size();
+	    indirect += used.size();
+	    converted++;
+	    continue;
+	}
+
+	if (f.map.size > FS_MAXFILEBLOCKS) {
+	    std::cerr << "inode block " << f.block << " has " << f.map.size
+		      << " blocks, more than a plain inode holds; left as it"
+		      << " is\n";
+	    skipped++;
+	    continue;
+	}
+
+	fs_inode plain;
+	memset(&plain, 0, sizeof(plain));
+	plain.type = kind;
+	strcpy(plain.owner, f.inode.owner);
+	plain.size = f.map.size;
+
+	std::vector<uint32_t> blocks = f.map.blocks();
+	std::copy(blocks.begin(), blocks.end(), plain.blocks);
+	disk.writeblock(f.block, &plain);
+
+	// Only once nothing refers to them
+	for (uint32_t b : f.map.meta) {
+	    free_blocks.release(b);
+	}
+	indirect += f.map.meta.size();
+	converted++;
+    }
+
+    if (pack_dirs) {
+	std::cout << "packed " << dirs << " directories, " << dir_blocks
+		  << " blocks into " << packed_blocks << ", " << skipped
+		  << " left as they were, " << free_blocks.free_count()
+		  << " disk blocks free\n";
+	return skipped ? 1 : 0;
+    }
+
+    if (inline_small) {
+	std::cout << "inlined " << inlined << " of " << all.inodes.size()
+		  << " inodes, " << free_blocks.free_count()
+		  << " disk blocks free\n";
+	return 0;
+    }
+
+    std::cout << "converted " << converted << " of " << all.inodes.size()
+	      << " inodes " << (reverse ? "to plain inodes" : "to extents");
+    if (!reverse) {
+	std::cout << " (" << extents << " extents, " << indirect
+		  << " indirect blocks)";
+    } else {
+	std::cout << " (" << indirect << " indirect blocks freed, "
+		  << inlined << " from inline inodes, " << dirs
+		  << " packed directories)";
+    }
+    std::cout << ", " << skipped << " left as they were, "
+	      << free_blocks.free_count() << " disk blocks free\n";
+    return skipped ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+#include "cow_tree.h"
+#include "inline_inode.h"
+#include "tree_walk.h"
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+// The blocks that the next version dropped from this one.  It keeps the
+// epoch of the next version alive, so its blocks are only freed once
+// every snapshot of this version or an earlier one is gone.
+struct cow_tree::epoch {
+    free_map                    &free;
+    std::vector<unsigned int>    blocks;
+    std::shared_ptr<epoch>       next;
+
+    explicit epoch(free_map &free_) : free(free_) {}
+
+    ~epoch()
+    {
+	for (unsigned int b : blocks) {
+	    free.release(b);
+	}
+
+	// Free the rest of the chain here, instead of with one nested
+	// destructor call per version.  Nobody else can get a reference to
+	// an epoch that only this chain holds.
+	std::shared_ptr<epoch> e = std::move(next);
+	while (e && e.use_count() == 1) {
+	    std::shared_ptr<epoch> after = std::move(e->next);
+	    e.reset();
+	    e = std::move(after);
+	}
+    }
+};
+
+cow_tree::snapshot::snapshot(block_device &disk_, uint64_t version,
+			     const fs_inode &root,
+			     std::shared_ptr<epoch> retired_)
+    : disk(disk_), number(version), root_inode(root),
+      retired(std::move(retired_))
+{
+}
+
+uint64_t cow_tree::snapshot::version() const
+{
+    return number;
+}
+
+const fs_inode &cow_tree::snapshot::root() const
+{
+    return root_inode;
+}
+
+fs_geometry cow_tree::snapshot::geometry() const
+{
+    return disk.geometry();
+}
+
+void cow_tree::snapshot::readblock(unsigned int block, void *buf)
+{
+    if (block == 0) {
+	memcpy(buf, &root_inode, FS_BLOCKSIZE);
+    } else {
+	disk.readblock(block, buf);
+    }
+}
+
+void cow_tree::snapshot::readblocks(const unsigned int *blocks,
+				    void *const *bufs, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++) {
+	if (blocks[i] == 0) {
+	    block_device::readblocks(blocks, bufs, n);
+	    return;
+	}
+    }
+    disk.readblocks(blocks, bufs, n);
+}
+
+void cow_tree::snapshot::writeblock(unsigned int block, const void *buf)
+{
+    assert(false);
+}
+
+namespace {
+
+// Records where the pointer to every block of the tree is.  There is
+// only one worker thread, so the callbacks need no lock.
+template <typename Parents>
+class parent_visitor : public tree_walk::visitor {
+    Parents &parents;
+
+public:
+    explicit parent_visitor(Parents &parents_) : parents(parents_) {}
+
+    void inode(const std::string &path, unsigned int block,
+	       const fs_inode &inode, const inode_map &map) override
+    {
+	assert(inode.type == 'd' || inode.type == 'f' ||
+	       inode.type == FS_INLINE_FILE);
+
+	std::vector<uint32_t> blocks = map.blocks();
+	for (unsigned int i = 0; i < blocks.size(); i++) {
+	    parents[blocks[i]] = {block, i};
+	}
+    }
+
+    void dirblock(const std::string &path, unsigned int index,
+		  unsigned int block, const fs_direntry *entries,
+		  unsigned int n) override
+    {
+	for (unsigned int j = 0; j < n; j++) {
+	    if (entries[j].inode_block) {
+		parents[entries[j].inode_block] = {block, j};
+	    }
+	}
+    }
+};
+
+} // namespace
+
+cow_tree::cow_tree(block_device &disk_, free_map &free_)
+    : disk(disk_), free(free_)
+{
+    parent_visitor<decltype(parents)> visit(parents);
+    tree_walk(disk, 1).run(visit);
+
+    fs_inode root;
+    disk.readblock(0, &root);
+    latest.reset(new snapshot(disk, 0, root, std::make_shared<epoch>(free)));
+}
+
+std::shared_ptr<cow_tree::snapshot> cow_tree::current() const
+{
+    return std::atomic_load(&latest);
+}
+
+cow_tree::update::update(cow_tree &tree_)
+    : tree(tree_), lock(tree_.writer), base(tree_.current())
+{
+}
+
+cow_tree::update::~update()
+{
+    if (!committed) {
+	for (unsigned int b : fresh) {
+	    tree.free.release(b);
+	}
+    }
+}
+
+void cow_tree::update::read(unsigned int block, void *buf)
+{
+    auto it = written.find(block);
+    if (it != written.end()) {
+	memcpy(buf, it->second.data, FS_BLOCKSIZE);
+    } else {
+	base->readblock(block, buf);
+    }
+}
+
+void cow_tree::update::write(unsigned int block, const void *buf)
+{
+    assert(!committed);
+    assert(block == 0 || fresh.count(block) || tree.parents.count(block));
+    assert(!released.count(block));
+
+    memcpy(written[block].data, buf, FS_BLOCKSIZE);
+}
+
+unsigned int cow_tree::update::allocate()
+{
+    assert(!committed);
+
+    unsigned int block = tree.free.allocate();
+    if (block) {
+	fresh.insert(block);
+    }
+    return block;
+}
+
+void cow_tree::update::release(unsigned int block)
+{
+    assert(!committed && block != 0);
+
+    written.erase(block);
+    if (fresh.erase(block)) {
+	// Nobody else has ever seen it
+	tree.free.release(block);
+    } else {
+	assert(tree.parents.count(block));
+	released.insert(block);
+    }
+}
+
+std::shared_ptr<cow_tree::snapshot> cow_tree::update::commit()
+{
+    assert(!committed);
+
+    // The blocks to copy: each block written that was in the tree, and
+    // its ancestors up to (not including) the root
+    std::map<unsigned int, unsigned int> copies;          // old -> new
+
+    for (auto &w : written) {
+	for (unsigned int b = w.first; b != 0 && !fresh.count(b) &&
+		 !released.count(b) && !copies.count(b);
+	     b = tree.parents.at(b).block) {
+	    copies[b] = 0;
+	}
+    }
+    for (auto &c : copies) {
+	c.second = tree.free.allocate();
+	if (!c.second) {
+	    for (auto &allocated : copies) {
+		if (allocated.second) {
+		    tree.free.release(allocated.second);
+		}
+	    }
+	    return nullptr;
+	}
+    }
+    committed = true;
+
+    // Walk down from the root through the changed blocks, pointing them
+    // at the copies and noting where every child's pointer now is
+    std::vector<std::pair<unsigned int, kind_t>>           work;
+    std::vector<unsigned int>                              targets;
+    std::vector<block>                                     contents;
+    std::vector<std::pair<unsigned int, parent_t>>         links;
+
+    work.emplace_back(0, inode_block);
+    while (!work.empty()) {
+	unsigned int b = work.back().first;
+	kind_t kind = work.back().second;
+	work.pop_back();
+
+	unsigned int to = b == 0 || fresh.count(b) ? b : copies.at(b);
+	targets.push_back(to);
+	contents.emplace_back();
+	read(b, contents.back().data);
+
+	auto link = [&](uint32_t &pointer, unsigned int slot, kind_t child) {
+	    auto it = copies.find(pointer);
+	    bool changed = it != copies.end() || fresh.count(pointer);
+	    if (changed) {
+		work.emplace_back(pointer, child);
+	    }
+	    if (it != copies.end()) {
+		pointer = it->second;
+	    }
+	    links.push_back({pointer, {to, slot}});
+	};
+
+	char *data = contents.back().data;
+	if (kind == inode_block) {
+	    fs_inode *inode = reinterpret_cast<fs_inode *>(data);
+	    assert(inode->type == 'd' || inode->type == 'f' ||
+		   inode->type == FS_INLINE_FILE);
+
+	    if (inode->type != FS_INLINE_FILE) {
+		kind_t child = inode->type == 'd' ? direntry_block
+						  : data_block;
+		for (unsigned int i = 0; i < inode->size; i++) {
+		    link(inode->blocks[i], i, child);
+		}
+	    }
+	} else if (kind == direntry_block) {
+	    fs_direntry *entries = reinterpret_cast<fs_direntry *>(data);
+	    for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+		if (entries[j].inode_block) {
+		    link(entries[j].inode_block, j, inode_block);
+		}
+	    }
+	}
+    }
+
+    // Each changed block was reached exactly once, through its parent
+    assert(targets.size() == 1 + copies.size() + fresh.size());
+
+    // Everything but the root first, then the root: until the root is
+    // written the old tree is intact on disk
+    std::vector<const void *> bufs;
+    for (unsigned int i = 1; i < contents.size(); i++) {
+	bufs.push_back(contents[i].data);
+    }
+    tree.disk.writeblocks(targets.data() + 1, bufs.data(), bufs.size());
+    tree.disk.writeblock(0, contents[0].data);
+
+    // The old blocks stay until the snapshots that can reach them are
+    // gone
+    std::vector<unsigned int> &retired = base->retired->blocks;
+    for (auto &c : copies) {
+	tree.parents.erase(c.first);
+	retired.push_back(c.first);
+    }
+    for (unsigned int b : released) {
+	tree.parents.erase(b);
+	retired.push_back(b);
+    }
+    for (auto &l : links) {
+	tree.parents[l.first] = l.second;
+    }
+
+    base->retired->next = std::make_shared<epoch>(tree.free);
+    std::shared_ptr<snapshot> next(
+	new snapshot(tree.disk, base->version() + 1,
+		     *reinterpret_cast<fs_inode *>(contents[0].data),
+		     base->retired->next));
+    std::atomic_store(&tree.latest, next);
+    return next;
+}
@@ -0,0 +1,169 @@
+/*
+ * cow_tree.h
+ *
+ * Copy-on-write updates of the file system tree, so that long-running
+ * readers (backups, full-tree dumps) can walk a consistent snapshot
+ * without any locks while a writer keeps changing the tree.
+ *
+ * Changes are made through an update.  When it commits, every block it
+ * wrote that was already in the tree goes to a newly allocated block
+ * instead, and so does each of their ancestors, with its pointers
+ * changed to the copies; blocks the update allocated itself are written
+ * in place.  The new root inode is written to block 0 last, so the tree
+ * on disk is always either the old one or the new one, and the new
+ * version is then published with a single atomic pointer store.
+ *
+ * A snapshot is a read-only block_device that serves one version of the
+ * tree: block 0 is that version's root inode, and no block reachable
+ * from it is written while the snapshot exists, so any walker (e.g.
+ * tree_walk) can run on it unchanged.  The blocks an update replaced
+ * or released return to the free map once no snapshot of that version
+ * or an earlier one is left; the snapshots' shared_ptrs do the counting,
+ * as for the objects of dynamic_map.
+ *
+ *     cow_tree tree(disk, free_blocks);
+ *
+ *     std::shared_ptr<cow_tree::snapshot> s = tree.current();
+ *     tree_walk(*s, 4).run(visitor);          // while updates go on
+ *
+ *     cow_tree::update u(tree);               // one writer at a time
+ *     unsigned int block = u.allocate();
+ *     u.write(block, &file_inode);
+ *     u.write(dirblock, entries);             // entries names block
+ *     u.commit();
+ *
+ * Blocks move whenever they are copied, inode blocks included, so an
+ * update should find what it changes by walking from the root rather
+ * than keep block numbers from earlier versions.  While a snapshot is
+ * held, every block replaced since stays in use as well, so a disk that
+ * is nearly full can run out of blocks for the copies.
+ *
+ * Only the plain format is handled: 'd' and 'f' inodes listing their
+ * blocks in blocks[], and inline files (see inline_inode.h).
+ */
+
+#ifndef _COW_TREE_H_
+#define _COW_TREE_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "block_device.h"
+#include "free_map.h"
+
+class cow_tree {
+    struct epoch;
+
+public:
+    class snapshot : public block_device {
+    public:
+	uint64_t version() const;
+	const fs_inode &root() const;
+
+	fs_geometry geometry() const override;
+
+	// REQUIRES: block is reachable from root() (or is block 0)
+	void readblock(unsigned int block, void *buf) override;
+	void readblocks(const unsigned int *blocks, void *const *bufs,
+			unsigned int n) override;
+
+	// REQUIRES: false (a snapshot is read only)
+	void writeblock(unsigned int block, const void *buf) override;
+
+    private:
+	friend class cow_tree;
+
+	snapshot(block_device &disk, uint64_t version, const fs_inode &root,
+		 std::shared_ptr<epoch> retired);
+
+	block_device                  &disk;
+	const uint64_t                 number;
+	const fs_inode                 root_inode;
+	const std::shared_ptr<epoch>   retired;   // what later versions drop
+    };
+
+    // REQUIRES: free is up to date for disk (see free_map::build), and
+    //           the tree on disk is in the plain format
+    // EFFECTS: reads the tree, which becomes version 0
+    cow_tree(block_device &disk, free_map &free);
+
+    // EFFECTS: returns the latest committed version of the tree, without
+    //          waiting for any update
+    std::shared_ptr<snapshot> current() const;
+
+    class update {
+    public:
+	// EFFECTS: starts an update of the latest version, waiting for
+	//          any other update to finish first
+	explicit update(cow_tree &tree);
+
+	// EFFECTS: if the update was not committed, drops its changes and
+	//          frees the blocks it allocated
+	~update();
+
+	update(const update &) = delete;
+	update &operator=(const update &) = delete;
+
+	// EFFECTS: reads block as this update has left it so far
+	void read(unsigned int block, void *buf);
+
+	// REQUIRES: block is in the tree, or was allocated by this update
+	void write(unsigned int block, const void *buf);
+
+	// EFFECTS: returns a free block for the update to link into the
+	//          tree, or 0 if the disk is full
+	unsigned int allocate();
+
+	// REQUIRES: block is not reachable from the root once the update
+	//           is done
+	// EFFECTS: once the update is committed, frees block when no
+	//          snapshot can still reach it
+	void release(unsigned int block);
+
+	// REQUIRES: not committed yet; every block written or allocated is
+	//           reachable from the root as the update has left it
+	// EFFECTS: writes the changes as described above, publishes them as
+	//          the next version and returns it.  Returns nullptr and
+	//          changes nothing if there are not enough free blocks
+	//          for the copies; the blocks of old snapshots are freed
+	//          as they are released, so it may be committed again.
+	std::shared_ptr<snapshot> commit();
+
+    private:
+	struct block {
+	    char data[FS_BLOCKSIZE];
+	};
+
+	// What a pointer in a block points to
+	enum kind_t { inode_block, direntry_block, data_block };
+
+	cow_tree                            &tree;
+	std::unique_lock<std::mutex>         lock;
+	const std::shared_ptr<snapshot>      base;
+	std::map<unsigned int, block>        written;
+	std::set<unsigned int>               fresh;     // allocated here
+	std::set<unsigned int>               released;  // were in the tree
+	bool                                 committed = false;
+    };
+
+private:
+    // Where the pointer to a block is: blocks[slot] of the inode at
+    // block, or the direntry at slot of the direntry block at block
+    struct parent_t {
+	unsigned int block;
+	unsigned int slot;
+    };
+
+    block_device                                &disk;
+    free_map                                    &free;
+    std::mutex                                   writer;    // updates
+    std::unordered_map<unsigned int, parent_t>   parents;   // by child
+    std::shared_ptr<snapshot>                    latest;    // atomic_*
+};
+
+#endif /* _COW_TREE_H_ */
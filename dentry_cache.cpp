@@ -0,0 +1,90 @@
+#include "dentry_cache.h"
+
+#include <cassert>
+
+dentry_cache::dentry_cache(unsigned int pinned)
+    : recent(pinned ? pinned : 1)
+{
+}
+
+dentry_cache::handle dentry_cache::get(uint32_t parent,
+				       std::string_view name)
+// EFFECTS: returns the entry for (parent, name), creating an unresolved
+//          one if none is alive, and marks it recently used
+{
+    handle d = entries.lookup(key_view(parent, name));
+
+    // Keep it alive for a while even if the caller drops it
+    unsigned int slot = next_recent.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_store(&recent[slot % recent.size()], d);
+
+    return d;
+}
+
+uint32_t dentry_cache::lookup(uint32_t parent, std::string_view name,
+			      const resolver &resolve)
+{
+    handle   d = get(parent, name);
+    uint32_t child = d->child.load(std::memory_order_acquire);
+
+    if (child == dentry::unresolved) {
+	// Two readers may both resolve a new entry; they hold the parent
+	// lock shared, so both see the same directory contents.
+	child = resolve(parent, std::string(name));
+	d->child.store(child, std::memory_order_release);
+	misses.fetch_add(1, std::memory_order_relaxed);
+    } else {
+	hits.fetch_add(1, std::memory_order_relaxed);
+	if (child == negative) {
+	    negative_hits.fetch_add(1, std::memory_order_relaxed);
+	}
+    }
+
+    return child;
+}
+
+uint32_t dentry_cache::resolve_path(const std::string &path,
+				    const resolver &resolve)
+{
+    assert(path.size() <= FS_MAXPATHNAME && !path.empty() && path[0] == '/');
+
+    std::string_view p(path);
+    uint32_t         block = 0;
+    std::size_t      start = 1;
+
+    while (start < p.size()) {
+	std::size_t end = p.find('/', start);
+	if (end == std::string_view::npos) {
+	    end = p.size();
+	}
+
+	block = lookup(block, p.substr(start, end - start), resolve);
+	if (block == negative) {
+	    return negative;
+	}
+	start = end + 1;
+    }
+
+    return block;
+}
+
+void dentry_cache::created(uint32_t parent, std::string_view name,
+			   uint32_t child)
+{
+    assert(child != negative && child != dentry::unresolved);
+    get(parent, name)->child.store(child, std::memory_order_release);
+}
+
+void dentry_cache::deleted(uint32_t parent, std::string_view name)
+{
+    get(parent, name)->child.store(negative, std::memory_order_release);
+}
+
+dentry_cache::stats_t dentry_cache::stats() const
+{
+    stats_t result;
+    result.hits = hits.load(std::memory_order_relaxed);
+    result.negative_hits = negative_hits.load(std::memory_order_relaxed);
+    result.misses = misses.load(std::memory_order_relaxed);
+    return result;
+}
@@ -0,0 +1,117 @@
+/*
+ * dentry_cache.h
+ *
+ * A cache of path name resolution results, mapping (parent directory
+ * inode block, component name) to the inode block of the child.  Names
+ * that were looked up and do not exist are cached too, as negative
+ * entries, so repeated misses do not rescan the directory.
+ *
+ * Entries are dynamic_map objects: as long as someone holds an entry
+ * (a request resolving a path, or the cache's own ring of recently used
+ * entries) the same one is returned and kept up to date; once nobody
+ * holds it, it evaporates.
+ *
+ * Locking: resolving a name from the disk requires the parent
+ * directory's lock (at least shared), and created/deleted require it
+ * exclusively, so a resolution never races with a change to the same
+ * directory.  The cache itself needs no lock: the dynamic_map is
+ * thread safe and the ring and counters are updated atomically.
+ */
+
+#ifndef _DENTRY_CACHE_H_
+#define _DENTRY_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "dynamic_map.h"
+#include "fs_server.h"
+
+class dentry_cache {
+public:
+    // Result of a path resolution: the child, or none
+    static const uint32_t negative = 0;
+
+    struct dentry {
+	// Inode block of the child, negative if it does not exist, or
+	// unresolved if the disk has not been consulted yet
+	static const uint32_t unresolved = UINT32_MAX;
+	std::atomic<uint32_t> child{unresolved};
+    };
+
+    using key = std::pair<uint32_t, std::string>;
+    using handle = std::shared_ptr<dentry>;
+
+    // Lookups use a key_view, so a name is only copied into a key
+    // when a new entry is made
+    using key_view = std::pair<uint32_t, std::string_view>;
+
+    struct key_hash {
+	std::size_t operator()(const key_view &k) const
+	{
+	    return std::hash<std::string_view>()(k.second) ^
+		   (std::hash<uint32_t>()(k.first) * 0x9e3779b97f4a7c15ull);
+	}
+    };
+
+    struct key_equal {
+	bool operator()(const key_view &a, const key_view &b) const
+	{
+	    return a == b;
+	}
+    };
+
+    // Reads the directory at parent and returns the inode block of name
+    // in it, or negative
+    using resolver = std::function<uint32_t(uint32_t parent,
+					    const std::string &name)>;
+
+    struct stats_t {
+	uint64_t hits = 0;             // answered from the cache
+	uint64_t negative_hits = 0;    // ... with a negative entry
+	uint64_t misses = 0;           // had to call the resolver
+    };
+
+    // EFFECTS: creates a cache that keeps at least the pinned most
+    //          recently used entries alive
+    explicit dentry_cache(unsigned int pinned = 1024);
+
+    // EFFECTS: returns the inode block of name in the directory at
+    //          parent, or negative, calling resolve on a cache miss
+    uint32_t lookup(uint32_t parent, std::string_view name,
+		    const resolver &resolve);
+
+    // REQUIRES: path is absolute ("/a/b"), at most FS_MAXPATHNAME long
+    // EFFECTS: returns the inode block that path names, or negative.
+    //          The root is block 0.
+    uint32_t resolve_path(const std::string &path, const resolver &resolve);
+
+    // EFFECTS: records that name was created in parent with the inode at
+    //          child, or that it was deleted
+    void created(uint32_t parent, std::string_view name, uint32_t child);
+    void deleted(uint32_t parent, std::string_view name);
+
+    stats_t stats() const;
+
+private:
+    dynamic_map<dentry, key, key_hash, key_equal>  entries;
+
+    // Strong references to recently used entries, replaced round-robin.
+    // The slots are only accessed with std::atomic_load/atomic_store.
+    std::vector<handle>                 recent;
+    std::atomic<unsigned int>           next_recent{0};
+
+    std::atomic<uint64_t>               hits{0};
+    std::atomic<uint64_t>               negative_hits{0};
+    std::atomic<uint64_t>               misses{0};
+
+    handle get(uint32_t parent, std::string_view name);
+};
+
+#endif /* _DENTRY_CACHE_H_ */
@@ -0,0 +1,160 @@
+#include "dir_index.h"
+#include "extent_inode.h"
+
+#include <cassert>
+
+void dir_index::load(block_device &disk, const fs_inode &dir)
+{
+    assert(inode_kind(dir) == 'd' && !is_packed_directory(dir));
+
+    inode_map map;
+    map.load(disk, dir);
+    std::vector<uint32_t> blocks = map.blocks();
+
+    names.clear();
+    free_slots.clear();
+    used_per_block.assign(map.size, 0);
+
+    // Read the whole directory with one vectored request
+    std::vector<fs_direntry>  entries(map.size * FS_DIRENTRIES);
+    std::vector<void *>       bufs(map.size);
+    for (unsigned int i = 0; i < map.size; i++) {
+	bufs[i] = &entries[i * FS_DIRENTRIES];
+    }
+    disk.readblocks(blocks.data(), bufs.data(), map.size);
+
+    names.reserve(map.size * FS_DIRENTRIES);
+
+    // The slots come in order, so each free one goes at the end
+    for (unsigned int i = 0; i < map.size; i++) {
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    const fs_direntry &d = entries[i * FS_DIRENTRIES + j];
+
+	    if (d.inode_block) {
+		names.emplace(d.name, entry{{i, j}, d.inode_block});
+		used_per_block[i]++;
+	    } else {
+		free_slots.insert(free_slots.end(), {i, j});
+	    }
+	}
+    }
+
+    is_loaded.store(true, std::memory_order_release);
+}
+
+bool dir_index::loaded() const
+{
+    return is_loaded.load(std::memory_order_acquire);
+}
+
+const dir_index::entry *dir_index::find(const std::string &name) const
+{
+    auto it = names.find(name);
+    return it == names.end() ? nullptr : &it->second;
+}
+
+bool dir_index::free_slot(location &where) const
+{
+    if (free_slots.empty()) {
+	return false;
+    }
+    where = *free_slots.begin();
+    return true;
+}
+
+void dir_index::insert(const std::string &name, location where,
+		       uint32_t inode_block)
+{
+    assert(!names.count(name));
+
+    auto it = free_slots.find(where);
+    assert(it != free_slots.end());
+    free_slots.erase(it);
+
+    names.emplace(name, entry{where, inode_block});
+    used_per_block[where.index]++;
+}
+
+void dir_index::erase(const std::string &name)
+{
+    auto it = names.find(name);
+    assert(it != names.end());
+
+    location where = it->second.where;
+    names.erase(it);
+    free_slots.insert(where);
+    used_per_block[where.index]--;
+}
+
+void dir_index::add_block(unsigned int index)
+{
+    assert(index == used_per_block.size());
+
+    used_per_block.push_back(0);
+    for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	free_slots.insert(free_slots.end(), {index, j});
+    }
+}
+
+void dir_index::remove_block(unsigned int index)
+{
+    assert(index < used_per_block.size() && !used_per_block[index]);
+
+    used_per_block.erase(used_per_block.begin() + index);
+
+    // Moving the later blocks down keeps the slots in order
+    std::set<location, scan_order> moved;
+    for (const location &l : free_slots) {
+	if (l.index != index) {
+	    moved.insert(moved.end(), {l.index - (l.index > index), l.slot});
+	}
+    }
+    free_slots.swap(moved);
+    for (auto &name : names) {
+	name.second.where.index -= (name.second.where.index > index);
+    }
+}
+
+unsigned int dir_index::used(unsigned int index) const
+{
+    assert(index < used_per_block.size());
+    return used_per_block[index];
+}
+
+unsigned int dir_index::size() const
+{
+    return names.size();
+}
+
+dir_index_table::dir_index_table(block_device &disk_)
+    : disk(disk_)
+{
+    assert(disk.geometry().block_size == FS_BLOCKSIZE);
+}
+
+dir_index &dir_index_table::get(unsigned int dir_block, const fs_inode &dir)
+{
+    slot *s;
+    {
+	std::lock_guard<std::mutex> lock(m);
+	std::unique_ptr<slot> &found = indexes[dir_block];
+	if (!found) {
+	    found.reset(new slot);
+	}
+	s = found.get();
+    }
+
+    // Lookups may hold the directory lock shared, so several of them can
+    // get here at once; one loads the index and the others wait for it.
+    // The disk read happens outside the table lock.
+    if (!s->index.loaded()) {
+	std::call_once(s->loading, [&] { s->index.load(disk, dir); });
+    }
+    return s->index;
+}
+
+void dir_index_table::invalidate(unsigned int dir_block)
+{
+    std::lock_guard<std::mutex> lock(m);
+    indexes.erase(dir_block);
+}
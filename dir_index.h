@@ -0,0 +1,133 @@
+/*
+ * dir_index.h
+ *
+ * An in-memory hash index of one directory's entries, mapping each name
+ * to the direntry slot that holds it, plus the set of unused slots in
+ * the directory's existing blocks.  Lookups, "is this name taken" checks
+ * and "find a free slot" are O(1) instead of a scan over up to
+ * FS_MAXFILEBLOCKS * FS_DIRENTRIES entries.  The free slots are kept in
+ * order (at O(log n) per change), so the lowest one is always handed out
+ * first and the directory is laid out just as a linear scan would.
+ *
+ * An index is built from the disk the first time its directory is
+ * used, and from then on must be updated alongside every change to the
+ * directory.  dir_index itself is not thread safe: callers must hold
+ * the directory's lock, as they already must to read or change it,
+ * shared to look up and exclusive to change.  dir_index_table, which
+ * hands out the indexes, is thread safe, and loads each index once even
+ * if several holders of the shared lock ask for it at the same time.
+ *
+ * Only plain directories are indexed; a packed directory (see
+ * packed_dir.h) has no fixed slots, and is searched a block at a time
+ * with the name hashes in each block instead.
+ */
+
+#ifndef _DIR_INDEX_H_
+#define _DIR_INDEX_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "block_device.h"
+
+class dir_index {
+public:
+    // A direntry slot: entry slot of the block at blocks[index]
+    struct location {
+	unsigned int index;
+	unsigned int slot;
+    };
+
+    struct entry {
+	location  where;
+	uint32_t  inode_block;
+    };
+
+    // REQUIRES: dir is the inode of a directory that is not packed
+    // EFFECTS: reads all of dir's direntry blocks and indexes them
+    void load(block_device &disk, const fs_inode &dir);
+    bool loaded() const;
+
+    // EFFECTS: returns the entry for name, or nullptr if there is none
+    const entry *find(const std::string &name) const;
+
+    // EFFECTS: returns true and sets where to the lowest unused slot in
+    //          the directory's blocks, or returns false if all are full
+    bool free_slot(location &where) const;
+
+    // REQUIRES: name is not in the directory, where is unused
+    // EFFECTS: records that the direntry at where now holds name
+    void insert(const std::string &name, location where,
+		uint32_t inode_block);
+
+    // REQUIRES: name is in the directory
+    // EFFECTS: records that name's direntry slot is unused
+    void erase(const std::string &name);
+
+    // REQUIRES: blocks[index] was just added to the directory, with no
+    //           used entries
+    void add_block(unsigned int index);
+
+    // REQUIRES: blocks[index] holds no used entries
+    // EFFECTS: records that blocks[index] was removed from the directory
+    //          and the blocks after it moved down by one
+    void remove_block(unsigned int index);
+
+    // EFFECTS: returns the number of used entries in blocks[index]
+    unsigned int used(unsigned int index) const;
+
+    unsigned int size() const;
+
+private:
+    // Orders slots as a linear scan meets them
+    struct scan_order {
+	bool operator()(const location &a, const location &b) const
+	{
+	    return a.index != b.index ? a.index < b.index : a.slot < b.slot;
+	}
+    };
+
+    std::atomic<bool>                       is_loaded{false};
+    std::unordered_map<std::string, entry>  names;
+    std::set<location, scan_order>          free_slots;
+    std::vector<unsigned int>               used_per_block;
+};
+
+/*
+ * dir_index_table
+ *
+ * The indexes of all directories, keyed by their inode block and built
+ * on first use.
+ */
+class dir_index_table {
+public:
+    // REQUIRES: disk has FS_BLOCKSIZE byte blocks
+    explicit dir_index_table(block_device &disk);
+
+    // REQUIRES: dir is the inode at dir_block, and the caller holds the
+    //           directory's lock (shared or exclusive)
+    // EFFECTS: returns the index of the directory, loading it if needed
+    dir_index &get(unsigned int dir_block, const fs_inode &dir);
+
+    // REQUIRES: the caller holds the directory's lock exclusively, and
+    //           no reference returned by get for it is still in use
+    // EFFECTS: forgets the index of a directory that was deleted
+    void invalidate(unsigned int dir_block);
+
+private:
+    struct slot {
+	std::once_flag  loading;
+	dir_index       index;
+    };
+
+    block_device                                         &disk;
+    std::mutex                                            m;
+    std::unordered_map<unsigned int, std::unique_ptr<slot>> indexes;
+};
+
+#endif /* _DIR_INDEX_H_ */
@@ -0,0 +1,212 @@
+#include "async_disk.h"
+#include "striped_disk.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+// Throughput of random block reads and writes with N threads, comparing
+// one global disk mutex (the way disk_readwrite in libfs_server.o works)
+// with striped_disk.  Then the time to read all FS_MAXFILEBLOCKS blocks
+// of a directory one at a time versus with one vectored readblocks.
+// Last, one thread reading random blocks synchronously versus keeping a
+// queue of async_disk requests in flight.
+//
+// Runs against a scratch image, not the file system disk.
+//
+//     usage: diskbench [max threads] [seconds per run] [write percent]
+
+// The "before" case: every request holds one mutex around lseek+read
+class global_disk : public block_device {
+    std::mutex m;
+    int        fd;
+
+public:
+    explicit global_disk(const std::string &path)
+    {
+	fd = open(path.c_str(), O_RDWR);
+	assert(fd >= 0);
+    }
+
+    ~global_disk()
+    {
+	close(fd);
+    }
+
+    void readblock(unsigned int block, void *buf) override
+    {
+	std::lock_guard<std::mutex> lock(m);
+	lseek(fd, off_t(block) * FS_BLOCKSIZE, SEEK_SET);
+	ssize_t n = read(fd, buf, FS_BLOCKSIZE);
+	assert(n == ssize_t(FS_BLOCKSIZE));
+    }
+
+    void writeblock(unsigned int block, const void *buf) override
+    {
+	std::lock_guard<std::mutex> lock(m);
+	lseek(fd, off_t(block) * FS_BLOCKSIZE, SEEK_SET);
+	ssize_t n = write(fd, buf, FS_BLOCKSIZE);
+	assert(n == ssize_t(FS_BLOCKSIZE));
+    }
+};
+
+double run(block_device &disk, unsigned int nthreads, double seconds,
+	   unsigned int write_percent)
+// EFFECTS: hammers disk with nthreads threads issuing random requests
+//          for the given time, and returns requests per second
+{
+    std::atomic<bool>      stop(false);
+    std::atomic<uint64_t>  total(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([&, t] {
+	    std::mt19937 rng(t + 1);
+	    std::uniform_int_distribution<unsigned int> block(0, FS_DISKSIZE-1);
+	    std::uniform_int_distribution<unsigned int> percent(0, 99);
+	    char buf[FS_BLOCKSIZE];
+	    uint64_t ops = 0;
+
+	    memset(buf, t, sizeof(buf));
+	    while (!stop.load(std::memory_order_relaxed)) {
+		if (percent(rng) < write_percent) {
+		    disk.writeblock(block(rng), buf);
+		} else {
+		    disk.readblock(block(rng), buf);
+		}
+		ops++;
+	    }
+	    total += ops;
+	});
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &thread : threads) {
+	thread.join();
+    }
+
+    return total / seconds;
+}
+
+double scan(block_device &disk, const fs_inode &dir, bool vectored,
+	    double seconds)
+// EFFECTS: repeatedly reads every block of dir for the given time, and
+//          returns directory scans per second
+{
+    static fs_direntry entries[FS_MAXFILEBLOCKS][FS_DIRENTRIES];
+    void              *bufs[FS_MAXFILEBLOCKS];
+    uint64_t           scans = 0;
+
+    for (unsigned int i = 0; i < dir.size; i++) {
+	bufs[i] = entries[i];
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+	if (vectored) {
+	    disk.readblocks(dir.blocks, bufs, dir.size);
+	} else {
+	    for (unsigned int i = 0; i < dir.size; i++) {
+		disk.readblock(dir.blocks[i], bufs[i]);
+	    }
+	}
+	scans++;
+	elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+
+    return scans / elapsed.count();
+}
+
+double queued(async_disk &disk, unsigned int depth, double seconds)
+// EFFECTS: reads random blocks for the given time from one thread,
+//          keeping depth requests in flight, and returns reads per second
+{
+    std::vector<std::future<void>> pending(depth);
+    std::vector<char>              bufs(depth * FS_BLOCKSIZE);
+    std::mt19937                   rng(1);
+    uint64_t                       reads = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+	for (unsigned int i = 0; i < depth; i++) {
+	    pending[i] = disk.submit_read(rng() % FS_DISKSIZE,
+					  &bufs[i * FS_BLOCKSIZE]);
+	}
+	for (auto &future : pending) {
+	    future.get();
+	}
+	reads += depth;
+	elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < seconds);
+
+    return reads / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    double       seconds = argc > 2 ? atof(argv[2]) : 0.5;
+    unsigned int write_percent = argc > 3 ? atoi(argv[3]) : 10;
+
+    // Build a zero-filled scratch image of the same size as the disk
+    std::string path = "/tmp/fs_bench." + std::to_string(getpid()) + ".disk";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    int status = ftruncate(fd, off_t(FS_DISKSIZE) * FS_BLOCKSIZE);
+    assert(status == 0);
+    close(fd);
+
+    global_disk  before(path);
+    striped_disk after(path);
+
+    std::cout << "threads  global mutex ops/s  striped ops/s  speedup\n";
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	double b = run(before, n, seconds, write_percent);
+	double a = run(after, n, seconds, write_percent);
+	std::cout << std::setw(7) << n << std::fixed << std::setprecision(0)
+		  << std::setw(20) << b << std::setw(15) << a
+		  << std::setprecision(2) << std::setw(9) << a / b << "x\n";
+    }
+
+    // A full directory, first with contiguous blocks, then scattered
+    fs_inode dir;
+    dir.type = 'd';
+    dir.size = FS_MAXFILEBLOCKS;
+
+    std::cout << "\ndirectory of " << FS_MAXFILEBLOCKS << " blocks"
+	      << "  readblock scans/s  readblocks scans/s  speedup\n";
+    for (const char *layout : {"contiguous", "scattered"}) {
+	std::mt19937 rng(1);
+	for (unsigned int i = 0; i < dir.size; i++) {
+	    dir.blocks[i] = layout[0] == 'c' ? i + 1 : rng() % FS_DISKSIZE;
+	}
+
+	double b = scan(after, dir, false, seconds);
+	double a = scan(after, dir, true, seconds);
+	std::cout << std::setw(25) << layout << std::fixed
+		  << std::setprecision(0) << std::setw(19) << b
+		  << std::setw(20) << a << std::setprecision(2)
+		  << std::setw(9) << a / b << "x\n";
+    }
+
+    async_disk async(path);
+
+    std::cout << "\nasync_disk (" << async.backend() << ") queue depth"
+	      << "  reads/s\n";
+    for (unsigned int depth = 1; depth <= 64; depth *= 4) {
+	std::cout << std::setw(29) << depth << std::setprecision(0)
+		  << std::setw(9) << queued(async, depth, seconds) << "\n";
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "free_map.h"
+#include "fs_dump.h"
+#include "fs_tool.h"
+#include "striped_disk.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Write a binary dump (see fs_dump.h) of the file system disk, which
+// formatfs -r restores.  The used blocks come from a parallel walk of
+// the tree (free_map), and are read with vectored requests of up to
+// 256 blocks and written out in large buffered chunks.  A dump file of
+// "-" is standard output.
+//
+//     usage: dumpfs [-t threads] dumpfile
+
+int main(int argc, char *argv[])
+{
+    unsigned int nthreads = 4;
+    int          arg = 1;
+
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+	nthreads = atoi(argv[2]);
+	arg = 3;
+    }
+    if (arg != argc - 1 || nthreads == 0) {
+	std::cerr << "usage: " << argv[0] << " [-t threads] dumpfile\n";
+	return 1;
+    }
+
+    auto         start = std::chrono::steady_clock::now();
+    striped_disk disk;
+    if (!fs_blocksize_disk(disk, argv[0])) {
+	return 1;
+    }
+    fs_geometry  g = disk.geometry();
+    free_map     free_blocks(g.disk_blocks);
+
+    free_blocks.build(disk, nthreads);
+
+    bool  to_stdout = !strcmp(argv[arg], "-");
+    FILE *out = to_stdout ? stdout : fopen(argv[arg], "wb");
+    if (!out) {
+	perror(argv[arg]);
+	return 1;
+    }
+    static char buffer[1 << 20];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+    fs_dump_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, fs_dump_magic, sizeof(h.magic));
+    h.version = 1;
+    h.block_size = g.block_size;
+    h.disk_blocks = g.disk_blocks;
+    h.used_blocks = g.disk_blocks - free_blocks.free_count();
+    fwrite(&h, sizeof(h), 1, out);
+
+    // Each run of used blocks, read a chunk at a time
+    const unsigned int         chunk = 256;
+    std::vector<char>          data(chunk * g.block_size);
+    std::vector<unsigned int>  blocks(chunk);
+    std::vector<void *>        bufs(chunk);
+    unsigned int               runs = 0;
+
+    for (unsigned int i = 0; i < chunk; i++) {
+	bufs[i] = &data[i * g.block_size];
+    }
+
+    for (unsigned int b = 0; b < g.disk_blocks; ) {
+	if (free_blocks.is_free(b)) {
+	    b++;
+	    continue;
+	}
+
+	fs_dump_run run = {b, 0};
+	while (run.start + run.count < g.disk_blocks &&
+	       !free_blocks.is_free(run.start + run.count)) {
+	    run.count++;
+	}
+	fwrite(&run, sizeof(run), 1, out);
+	runs++;
+
+	for (unsigned int done = 0; done < run.count; done += chunk) {
+	    unsigned int n = std::min(chunk, run.count - done);
+	    for (unsigned int i = 0; i < n; i++) {
+		blocks[i] = run.start + done + i;
+	    }
+	    disk.readblocks(blocks.data(), bufs.data(), n);
+	    fwrite(data.data(), g.block_size, n, out);
+	}
+	b = run.start + run.count;
+    }
+
+    fs_dump_run end = {0, 0};
+    fwrite(&end, sizeof(end), 1, out);
+
+    if (fflush(out) || ferror(out)) {
+	perror(argv[arg]);
+	return 1;
+    }
+    if (!to_stdout) {
+	fclose(out);
+    }
+
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+    std::cerr << h.used_blocks << " blocks in " << runs << " runs dumped in "
+	      << elapsed.count() << " seconds\n";
+    return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * dynamic_map.h
+ *
+ * The Dynamic Map (from dynmap.cpp), as a template usable by the file
+ * server.
+ *
+ * Maps keys to objects, dynamically creating an object for a key as it
+ * is used.  If a client has an active reference to the object for a
+ * particular key, any later lookups return the same one.  Once no
+ * client holds a reference, the object is destroyed and the next lookup
+ * creates a new one.
+ *
+ * The map is thread safe.  It is split into shards by the hash of the
+ * key, each with its own lock, so lookups of keys in different shards
+ * never wait for each other.  Within a shard, finding the live object
+ * or creating a new one happens under the shard lock, so two
+ * concurrent lookups of one key always get the same object.
+ *
+ * Each shard is an open addressing hash table with linear probing.  A
+ * lookup probes once: the probe ends either at the key's slot or at
+ * the empty slot where the new object goes.  Lookups are heterogeneous:
+ * any type that Hash and Equal accept along with Key works, such as a
+ * std::string_view or a char array for std::string keys, and is only
+ * converted to a Key when a new entry is made.
+ *
+ * The map only holds entries for live objects.  Each object is created
+ * with a deleter that, after destroying it, erases the object's slot
+ * (unless a newer object has taken it over in the meantime).  The
+ * deleter only refers to its shard weakly, so objects may outlive the
+ * map.  As a safety net, expired entries are also dropped whenever a
+ * shard's table is rebuilt to grow or shrink, and sweep() drops them
+ * on demand.
+ */
+
+#ifndef _DYNAMIC_MAP_H_
+#define _DYNAMIC_MAP_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Default hash of dynamic_map: std::hash, except that std::string keys
+// hash through std::string_view so the two can be used interchangeably
+template <typename Key>
+struct dynamic_map_hash : std::hash<Key> {
+};
+
+template <>
+struct dynamic_map_hash<std::string> {
+    std::size_t operator()(std::string_view s) const
+    {
+	return std::hash<std::string_view>()(s);
+    }
+};
+
+inline std::size_t dynamic_map_mix(std::size_t h)
+// EFFECTS: scrambles h (the MurmurHash3 finalizer), since std::hash is
+//          often the identity and both the shard and the slot are taken
+//          from its bits
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// REQUIRES: Key is default constructible; Hash and Equal are stateless
+template <typename T, typename Key = std::string,
+	  typename Hash = dynamic_map_hash<Key>,
+	  typename Equal = std::equal_to<>>
+class dynamic_map {
+    struct slot {
+	bool              used = false;
+	std::size_t       hash = 0;          // see dynamic_map_mix()
+	Key               key{};
+	std::weak_ptr<T>  object;
+    };
+
+    // Each shard on its own cache line, so shard locks do not contend
+    struct alignas(64) shard {
+	std::mutex         m;
+	std::vector<slot>  slots;            // a power of two in size, or 0
+	std::size_t        count = 0;        // used slots
+    };
+
+    // Deleter of the objects: destroys the object, then erases its slot
+    class eraser {
+	std::weak_ptr<shard>  owner;
+	std::size_t           hash;
+	Key                   key;
+
+    public:
+	eraser(const std::shared_ptr<shard> &owner, std::size_t hash,
+	       Key &&key);
+	void operator()(T *object);
+    };
+
+    std::vector<std::shared_ptr<shard>>  shards;
+
+    static const std::size_t min_slots = 16;
+
+    template <typename K>
+    static std::size_t probe(const shard &s, std::size_t h, const K &k);
+    static void erase(shard &s, std::size_t i);
+    static std::size_t rebuild(shard &s, std::size_t extra);
+
+public:
+    // REQUIRES: nshards > 0
+    explicit dynamic_map(unsigned int nshards = 16);
+
+    template <typename K, typename... Args>
+    std::shared_ptr<T> lookup(const K &k, Args &&... args);
+
+    // EFFECTS: erases all entries whose objects are gone, returning how
+    //          many there were
+    std::size_t sweep();
+
+    // EFFECTS: returns the number of entries
+    std::size_t size() const;
+};
+
+template <typename T, typename Key, typename Hash, typename Equal>
+template <typename K>
+std::size_t dynamic_map<T, Key, Hash, Equal>::probe(const shard &s,
+						    std::size_t h,
+						    const K &k)
+// REQUIRES: s.m is held, s has at least one unused slot
+//
+// EFFECTS: returns the slot holding k, or else the unused slot where k
+//          belongs
+{
+    std::size_t mask = s.slots.size() - 1;
+
+    for (std::size_t i = h & mask; ; i = (i + 1) & mask) {
+	const slot &x = s.slots[i];
+	if (!x.used || (x.hash == h && Equal()(x.key, k))) {
+	    return i;
+	}
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void dynamic_map<T, Key, Hash, Equal>::erase(shard &s, std::size_t i)
+// REQUIRES: s.m is held, slot i is used
+//
+// MODIFIES: s
+//
+// EFFECTS: empties slot i.  Later slots of the same probe run are
+//          shifted back, so no tombstones are needed.
+{
+    std::size_t mask = s.slots.size() - 1;
+
+    for (std::size_t j = (i + 1) & mask; s.slots[j].used; j = (j + 1) & mask) {
+	// The entry at j can fill the hole if the hole lies between its
+	// home slot and j
+	std::size_t home = s.slots[j].hash & mask;
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    s.slots[i] = std::move(s.slots[j]);
+	    i = j;
+	}
+    }
+
+    s.slots[i] = slot();
+    s.count--;
+
+    // Give the memory back once the shard is mostly empty
+    if (s.slots.size() > min_slots && s.count * 8 < s.slots.size()) {
+	rebuild(s, 0);
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+std::size_t dynamic_map<T, Key, Hash, Equal>::rebuild(shard &s,
+						      std::size_t extra)
+// REQUIRES: s.m is held
+//
+// MODIFIES: s
+//
+// EFFECTS: rehashes the live entries of s into a table that is at most
+//          half full even after extra more insertions, dropping the
+//          expired entries.  Returns the number dropped.
+{
+    std::size_t live = 0;
+    for (const slot &x : s.slots) {
+	live += x.used && !x.object.expired();
+    }
+
+    std::size_t size = min_slots;
+    while ((live + extra) * 2 > size) {
+	size *= 2;
+    }
+
+    std::vector<slot> old(size);
+    old.swap(s.slots);
+
+    std::size_t dropped = s.count - live;
+    s.count = 0;
+
+    std::size_t mask = size - 1;
+    for (slot &x : old) {
+	if (x.used && !x.object.expired()) {
+	    std::size_t i = x.hash & mask;
+	    while (s.slots[i].used) {
+		i = (i + 1) & mask;
+	    }
+	    s.slots[i] = std::move(x);
+	    s.count++;
+	}
+    }
+
+    return dropped;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+dynamic_map<T, Key, Hash, Equal>::eraser::eraser(
+    const std::shared_ptr<shard> &owner_, std::size_t hash_, Key &&key_)
+    : owner(owner_), hash(hash_), key(std::move(key_))
+{
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void dynamic_map<T, Key, Hash, Equal>::eraser::operator()(T *object)
+// EFFECTS: destroys object, then erases its entry if the map still
+//          exists and no newer object has been created for the key
+{
+    // Outside the shard lock: the destructor may use the map itself
+    delete object;
+
+    std::shared_ptr<shard> s = owner.lock();
+    if (!s) {
+	return;
+    }
+
+    std::lock_guard<std::mutex> lock(s->m);
+
+    if (s->slots.empty()) {
+	return;
+    }
+
+    std::size_t i = probe(*s, hash, key);
+    if (s->slots[i].used && s->slots[i].object.expired()) {
+	erase(*s, i);
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+dynamic_map<T, Key, Hash, Equal>::dynamic_map(unsigned int nshards)
+{
+    shards.resize(nshards ? nshards : 1);
+    for (std::shared_ptr<shard> &s : shards) {
+	s = std::make_shared<shard>();
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+template <typename K, typename... Args>
+std::shared_ptr<T> dynamic_map<T, Key, Hash, Equal>::lookup(const K &k,
+							    Args &&... args)
+// MODIFIES: this
+//
+// EFFECTS: Returns a shared_ptr to the object currently assigned to
+//          the key k. If a previous lookup result for a particular
+//          key (or any copy of it) still exists, this lookup should
+//          return the same result. If this lookup has never been made,
+//          or no (copy of) any prior lookup still exists, should return
+//          a new object, constructed from args. Is thread-safe
+{
+    std::size_t                   h = dynamic_map_mix(Hash()(k));
+    const std::shared_ptr<shard> &s = shards[(h >> 32) % shards.size()];
+    std::lock_guard<std::mutex>   lock(s->m);
+
+    // Keep the table at most 3/4 full, so probes stay short and always
+    // end.  Growing first means one probe serves both a hit and a miss.
+    if ((s->count + 1) * 4 > s->slots.size() * 3) {
+	rebuild(*s, 1);
+    }
+
+    // Find the slot of the weak pointer (or where it goes)
+    slot &x = s->slots[probe(*s, h, k)];
+
+    // Try to get the underlying object (if it exists)
+    std::shared_ptr<T> result = x.object.lock();
+
+    if (!result) {
+	// There is no current underlying object. Need one, which erases
+	// its own entry when it goes away.
+	if (!x.used) {
+	    x.key = Key(k);
+	}
+	result = std::shared_ptr<T>(new T(std::forward<Args>(args)...),
+				    eraser(s, h, Key(x.key)));
+
+	// This stores a weak reference to result in the slot
+	if (!x.used) {
+	    x.used = true;
+	    x.hash = h;
+	    s->count++;
+	}
+	x.object = result;
+    }
+
+    // This passes ownership of the managed object to the caller
+    return result;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+std::size_t dynamic_map<T, Key, Hash, Equal>::sweep()
+{
+    std::size_t dropped = 0;
+
+    for (const std::shared_ptr<shard> &s : shards) {
+	std::lock_guard<std::mutex> lock(s->m);
+	if (s->count) {
+	    dropped += rebuild(*s, 0);
+	}
+    }
+    return dropped;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+std::size_t dynamic_map<T, Key, Hash, Equal>::size() const
+{
+    std::size_t total = 0;
+
+    for (const std::shared_ptr<shard> &s : shards) {
+	std::lock_guard<std::mutex> lock(s->m);
+	total += s->count;
+    }
+    return total;
+}
+
+#endif /* _DYNAMIC_MAP_H_ */
@@ -1,27 +1,29 @@
 #include <cassert>
 #include <ctime>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <string>
 
+#include "dynamic_map.h"
+#include "id_allocator.h"
+
 // Demonstrate the use of shared/weak pointers to manage "on demand"
 // dynamic structures.
 
 // This is a simple structure that counts allocations
 
 struct serial_no {
-    static unsigned int number;
+    // Serial numbers 1, 2, ...; safe to take from any thread
+    using numbers = id_allocator<serial_no, 1>;
+
     const unsigned int this_num;
 
     serial_no();
     ~serial_no();
 };
 
-unsigned int serial_no::number = 1;
-
 serial_no::serial_no()
-    : this_num(number++)
+    : this_num(numbers::allocate())
 {
     std::cout << "Creating serial # " << this_num << "\n";
 }
@@ -32,53 +34,25 @@ serial_no::~serial_no()
 }
 
 
-// The Dynamic Map
+// The Dynamic Map (see dynamic_map.h)
 //
 // Maps from strings to serial numbers, dynamcially assigniung serial
-// numbers to strings as they are used.
-//
-// If a client has an active reference to a partcular serial number,
-// any later lookups should return the same one. Once no clients have
-// any active serial numbers, the next lookup should get a new serial
-// number.
-
-class dynamic_map {
-    std::map<std::string, std::weak_ptr<serial_no>>  map;
+// numbers to strings as they are used. This one also reports each
+// lookup.
 
+class verbose_map : public dynamic_map<serial_no> {
 public:
     std::shared_ptr<serial_no> lookup(const std::string &s);
 };
 
 
-std::shared_ptr<serial_no> dynamic_map::lookup(const std::string &s)
+std::shared_ptr<serial_no> verbose_map::lookup(const std::string &s)
 // MODIFIES: this
 //
 // EFFECTS: Returns a shared_ptr to the serial number currently
-//          assigned to the string s. If a previous lookup result for
-//          a particular string (or any copy of it) still exists, this
-//          lookup should return the same result. If this lookup has
-//          never been made, or no (copy of) any prior lookup still
-//          exists, should return a newly-allocated serial number.
+//          assigned to the string s, as dynamic_map::lookup does.
 {
-    std::shared_ptr<serial_no>  result = nullptr;
-
-    // Look up the weak pointer (creating it if it does not exist)
-    std::weak_ptr<serial_no> tentative = map[s];
-
-    // Try to get the underlying serial number (if it exists)
-    result = tentative.lock();
-
-    if (!result) {
-	// There is no current underlying serial number. Need one.
-	// This allocates a serial_no via new(), and then assigned it
-	// to be managed by result.
-	result = std::make_shared<serial_no>();
-
-	// This stores a weak reference to result in the map at s
-	map[s] = result;
-    }
-
-    // This passes ownership of the managed serial_no to the caller
+    std::shared_ptr<serial_no> result = dynamic_map<serial_no>::lookup(s);
 
     std::cout << "Lookup of " << s << " returns # "
 	      << result->this_num << "\n";
@@ -88,7 +62,7 @@ std::shared_ptr<serial_no> dynamic_map::lookup(const std::string &s)
 
 int main()
 {
-    dynamic_map                m;
+    verbose_map                m;
 
     // Instantiate serial #s for P and Q
     std::cout << "First block\n--------------------------\n";
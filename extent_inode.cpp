@@ -0,0 +1,182 @@
+#include "extent_inode.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// Adds up to n of extents to map, until it covers remaining blocks.
+// Returns the number of blocks still missing.
+uint32_t take(inode_map &map, const fs_extent *extents, unsigned int n,
+	      uint32_t remaining)
+{
+    for (unsigned int i = 0; i < n && remaining > 0; i++) {
+	// A zero length extent before the end means a corrupt inode
+	assert(extents[i].length > 0 && extents[i].length <= remaining);
+
+	for (uint32_t b = 0; b < extents[i].length; b++) {
+	    map.append(extents[i].start + b);
+	}
+	remaining -= extents[i].length;
+    }
+    return remaining;
+}
+
+} // namespace
+
+void inode_map::load(block_device &disk, const fs_inode &inode)
+{
+    extents.clear();
+    meta.clear();
+    size = 0;
+
+    if (is_inline_inode(inode)) {
+	return;
+    }
+
+    if (!is_extent_inode(inode)) {
+	for (unsigned int i = 0; i < inode.size; i++) {
+	    append(inode.blocks[i]);
+	}
+	return;
+    }
+
+    fs_extent_inode x;
+    memcpy(&x, &inode, sizeof(x));
+
+    uint32_t remaining = take(*this, x.extents, FS_INODE_EXTENTS, x.size);
+
+    fs_extent more[FS_BLOCK_EXTENTS];
+    if (remaining > 0) {
+	assert(x.indirect);
+	disk.readblock(x.indirect, more);
+	meta.push_back(x.indirect);
+	remaining = take(*this, more, FS_BLOCK_EXTENTS, remaining);
+    }
+
+    if (remaining > 0) {
+	assert(x.double_indirect);
+
+	uint32_t pointers[FS_BLOCK_POINTERS];
+	disk.readblock(x.double_indirect, pointers);
+	meta.push_back(x.double_indirect);
+
+	for (unsigned int i = 0; i < FS_BLOCK_POINTERS && remaining > 0; i++) {
+	    assert(pointers[i]);
+	    disk.readblock(pointers[i], more);
+	    meta.push_back(pointers[i]);
+	    remaining = take(*this, more, FS_BLOCK_EXTENTS, remaining);
+	}
+	assert(remaining == 0);
+    }
+}
+
+void inode_map::append(uint32_t block)
+{
+    if (!extents.empty() &&
+	extents.back().start + extents.back().length == block) {
+	extents.back().length++;
+    } else {
+	extents.push_back({block, 1});
+    }
+    size++;
+}
+
+std::vector<uint32_t> inode_map::blocks() const
+{
+    std::vector<uint32_t> result;
+
+    result.reserve(size);
+    for (const fs_extent &e : extents) {
+	for (uint32_t b = 0; b < e.length; b++) {
+	    result.push_back(e.start + b);
+	}
+    }
+    return result;
+}
+
+bool write_extent_inode(block_device &disk, unsigned int block, char kind,
+			const char *owner, const inode_map &map,
+			const std::function<unsigned int()> &allocate,
+			const std::function<void(unsigned int)> &release,
+			std::vector<uint32_t> *indirect)
+{
+    assert(kind == 'f' || kind == 'd');
+    assert(strlen(owner) <= FS_MAXUSERNAME);
+
+    std::size_t n = map.extents.size();
+    std::size_t spill = n > FS_INODE_EXTENTS ? n - FS_INODE_EXTENTS : 0;
+    std::size_t spill2 = spill > FS_BLOCK_EXTENTS ? spill - FS_BLOCK_EXTENTS
+						  : 0;
+    std::size_t nindirect = (spill2 + FS_BLOCK_EXTENTS - 1) / FS_BLOCK_EXTENTS;
+    assert(nindirect <= FS_BLOCK_POINTERS);
+
+    // Take every block needed before writing anything: the single
+    // indirect block, then the double indirect block and its children
+    std::vector<uint32_t> taken;
+    std::size_t needed = (spill > 0) + (spill2 > 0) + nindirect;
+    while (taken.size() < needed) {
+	unsigned int b = allocate();
+	if (!b) {
+	    for (uint32_t t : taken) {
+		release(t);
+	    }
+	    return false;
+	}
+	taken.push_back(b);
+    }
+
+    fs_extent_inode x;
+    memset(&x, 0, sizeof(x));
+    x.type = kind == 'd' ? FS_EXTENT_DIRECTORY : FS_EXTENT_FILE;
+    strcpy(x.owner, owner);
+    x.size = map.size;
+
+    const fs_extent *next = map.extents.data();
+    std::size_t      left = n;
+
+    std::size_t k = std::min<std::size_t>(left, FS_INODE_EXTENTS);
+    memcpy(x.extents, next, k * sizeof(fs_extent));
+    next += k;
+    left -= k;
+
+    // Extent blocks before the blocks that point to them
+    auto write_extents = [&](uint32_t b) {
+	fs_extent more[FS_BLOCK_EXTENTS];
+	memset(more, 0, sizeof(more));
+	std::size_t count = std::min<std::size_t>(left, FS_BLOCK_EXTENTS);
+	memcpy(more, next, count * sizeof(fs_extent));
+	next += count;
+	left -= count;
+	disk.writeblock(b, more);
+    };
+
+    if (spill > 0) {
+	x.indirect = taken[0];
+	write_extents(x.indirect);
+    }
+    if (spill2 > 0) {
+	x.double_indirect = taken[1];
+
+	uint32_t pointers[FS_BLOCK_POINTERS];
+	memset(pointers, 0, sizeof(pointers));
+	for (std::size_t i = 0; i < nindirect; i++) {
+	    pointers[i] = taken[2 + i];
+	    write_extents(pointers[i]);
+	}
+	disk.writeblock(x.double_indirect, pointers);
+    }
+    assert(left == 0);
+
+    // An fs_inode sized buffer, so the whole block is defined
+    fs_inode buf;
+    memset(&buf, 0, sizeof(buf));
+    memcpy(&buf, &x, sizeof(x));
+    disk.writeblock(block, &buf);
+
+    if (indirect) {
+	indirect->insert(indirect->end(), taken.begin(), taken.end());
+    }
+    return true;
+}
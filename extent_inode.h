@@ -0,0 +1,123 @@
+/*
+ * extent_inode.h
+ *
+ * A second on-disk inode format that describes a file's data blocks as
+ * extents, (start, length) runs of consecutive blocks, instead of one
+ * pointer per block.  A sequential file is a handful of extents however
+ * long it is, and each extent can be read with one multi-block request.
+ *
+ * An extent inode is one block, like an fs_inode, and starts the same
+ * way (type, owner, size in blocks), but its type is FS_EXTENT_FILE or
+ * FS_EXTENT_DIRECTORY.  Its extents, in file order, are
+ *
+ *     extents[]                 FS_INODE_EXTENTS in the inode
+ *     indirect                  a block of FS_BLOCK_EXTENTS more
+ *     double_indirect           a block of FS_BLOCK_POINTERS blocks like
+ *                               indirect
+ *
+ * taking as many as are needed to cover size blocks.  indirect and
+ * double_indirect are 0 when unused.  Both formats can be mixed on one
+ * disk, so an image can be converted an inode at a time (see
+ * convertfs.cpp).
+ *
+ * inode_map reads the block map of an inode in either format.
+ */
+
+#ifndef _EXTENT_INODE_H_
+#define _EXTENT_INODE_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "block_device.h"
+#include "inline_inode.h"
+#include "packed_dir.h"
+
+static const char FS_EXTENT_FILE = 'F';
+static const char FS_EXTENT_DIRECTORY = 'D';
+
+struct fs_extent {
+    uint32_t start;                        // first block of the run
+    uint32_t length;                       // number of blocks
+};
+
+/*
+ * Extents in an extent inode (after type, owner, size, indirect and
+ * double_indirect), and in an indirect block
+ */
+static const unsigned int FS_INODE_EXTENTS =
+    (FS_BLOCKSIZE - (FS_MAXUSERNAME + 2) - 3 * sizeof(uint32_t))
+    / sizeof(fs_extent);
+static const unsigned int FS_BLOCK_EXTENTS = FS_BLOCKSIZE / sizeof(fs_extent);
+
+/*
+ * Indirect block numbers in a double indirect block
+ */
+static const unsigned int FS_BLOCK_POINTERS = FS_BLOCKSIZE / sizeof(uint32_t);
+
+struct fs_extent_inode {
+    char type;                             // FS_EXTENT_FILE or
+					   // FS_EXTENT_DIRECTORY
+    char owner[FS_MAXUSERNAME + 1];        // owner of this file or directory
+    uint32_t size;                         // size of this file or directory
+					   // in blocks
+    uint32_t indirect;                     // block of more extents, or 0
+    uint32_t double_indirect;              // block of indirect blocks, or 0
+    fs_extent extents[FS_INODE_EXTENTS];
+};
+
+static_assert(sizeof(fs_extent_inode) <= FS_BLOCKSIZE,
+	      "an extent inode must fit in a block");
+static_assert(sizeof(fs_inode) == FS_BLOCKSIZE,
+	      "an inode block is read into an fs_inode");
+
+inline bool is_extent_inode(const fs_inode &inode)
+{
+    return inode.type == FS_EXTENT_FILE || inode.type == FS_EXTENT_DIRECTORY;
+}
+
+// EFFECTS: returns 'f' or 'd' for an inode of any format (including
+//          inline files and packed directories, see inline_inode.h and
+//          packed_dir.h)
+inline char inode_kind(const fs_inode &inode)
+{
+    return inode.type == FS_EXTENT_DIRECTORY ||
+	   inode.type == FS_PACKED_DIRECTORY ? 'd'
+	 : inode.type == FS_EXTENT_FILE || inode.type == FS_INLINE_FILE ? 'f'
+	 : inode.type;
+}
+
+// The data blocks of an inode, of either format
+class inode_map {
+public:
+    std::vector<fs_extent>  extents;   // in file order, adjacent ones merged
+    std::vector<uint32_t>   meta;      // indirect blocks read along the way
+    uint32_t                size = 0;  // data blocks
+
+    // EFFECTS: replaces the map with that of inode, reading its indirect
+    //          blocks (if any) from disk.  An inline inode has no data
+    //          blocks.
+    void load(block_device &disk, const fs_inode &inode);
+
+    // EFFECTS: appends block as the next data block
+    void append(uint32_t block);
+
+    // EFFECTS: returns the data blocks in file order
+    std::vector<uint32_t> blocks() const;
+};
+
+// EFFECTS: writes an extent inode of kind ('f' or 'd'), owner and the
+//          data blocks in map to block.  Indirect blocks come from
+//          allocate (which returns 0 when the disk is full) and are
+//          written before the inode; if indirect is given, they are
+//          appended to it.  Returns false if allocate ran out, in which
+//          case nothing is written and the blocks taken are handed back
+//          to release.
+bool write_extent_inode(block_device &disk, unsigned int block, char kind,
+			const char *owner, const inode_map &map,
+			const std::function<unsigned int()> &allocate,
+			const std::function<void(unsigned int)> &release,
+			std::vector<uint32_t> *indirect = nullptr);
+
+#endif /* _EXTENT_INODE_H_ */
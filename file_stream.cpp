@@ -0,0 +1,187 @@
+#include "file_stream.h"
+#include "extent_inode.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+file_stream::file_stream(block_device &disk_, const fs_inode &inode_,
+			 unsigned int max_window_, unsigned int max_dirty_)
+    : disk(disk_), inode(inode_), max_window(max_window_),
+      max_dirty(max_dirty_)
+{
+    assert(inode_kind(inode) == 'f' && max_dirty > 0);
+    assert(disk.geometry().block_size == FS_BLOCKSIZE);
+
+    inode_map map;
+    map.load(disk, inode);
+    data_blocks = map.blocks();
+}
+
+file_stream::~file_stream()
+{
+    flush();
+}
+
+unsigned int file_stream::size() const
+{
+    return is_inline_inode(inode) ? inode.size : data_blocks.size();
+}
+
+file_stream::window *file_stream::find(unsigned int index)
+{
+    for (window &w : windows) {
+	if (index >= w.first && index < w.first + w.count) {
+	    return &w;
+	}
+    }
+    return nullptr;
+}
+
+void file_stream::prefetch(unsigned int first)
+// EFFECTS: starts reading the next window of blocks from first, if
+//          there are any
+{
+    ahead = ahead ? std::min(2 * ahead, max_window)
+		  : std::min(4u, max_window);
+
+    unsigned int count = std::min(ahead, size() - std::min(first, size()));
+    if (!count) {
+	return;
+    }
+
+    windows.emplace_back();
+    window &w = windows.back();
+    w.first = first;
+    w.count = count;
+    w.data.resize(count * FS_BLOCKSIZE);
+
+    std::vector<unsigned int> blocks(data_blocks.begin() + first,
+				     data_blocks.begin() + first + count);
+    std::vector<void *> bufs(count);
+    for (unsigned int i = 0; i < count; i++) {
+	bufs[i] = &w.data[i * FS_BLOCKSIZE];
+    }
+
+    // Elements of a deque stay put as others come and go, so the
+    // buffers outlive the request (a window is only dropped once its
+    // future, which waits for the request, is destroyed)
+    block_device *d = &disk;
+    w.ready = std::async(std::launch::async,
+			 [d, blocks = std::move(blocks),
+			  bufs = std::move(bufs)] {
+			     d->readblocks(blocks.data(), bufs.data(),
+					   blocks.size());
+			 });
+
+    counters.prefetched += count;
+    counters.requests++;
+}
+
+void file_stream::read(unsigned int index, void *buf)
+{
+    assert(index < size());
+
+    bool sequential = index == next;
+    next = index + 1;
+    counters.reads++;
+
+    auto it = dirty.find(index);
+    if (it != dirty.end()) {
+	memcpy(buf, it->second.data(), FS_BLOCKSIZE);
+	return;
+    }
+
+    if (is_inline_inode(inode)) {
+	read_file_block(disk, inode, index, buf);
+	return;
+    }
+
+    if (!sequential || !max_window) {
+	windows.clear();
+	ahead = 0;
+	disk.readblock(data_blocks[index], buf);
+	counters.requests++;
+	return;
+    }
+
+    window *w = find(index);
+    if (!w) {
+	windows.clear();
+	ahead = 0;
+	prefetch(index);
+	w = &windows.back();
+    }
+
+    w->ready.wait();
+    memcpy(buf, &w->data[(index - w->first) * FS_BLOCKSIZE], FS_BLOCKSIZE);
+
+    // Entering the last window: start the one after it
+    if (index == w->first && w == &windows.back()) {
+	prefetch(w->first + w->count);
+    }
+
+    // The windows before this one are used up
+    while (windows.front().first + windows.front().count <= index) {
+	windows.pop_front();
+    }
+}
+
+void file_stream::write(unsigned int index, const void *buf)
+{
+    assert(index < size() && !is_inline_inode(inode));
+
+    std::vector<char> &data = dirty[index];
+    data.assign(static_cast<const char *>(buf),
+		static_cast<const char *>(buf) + FS_BLOCKSIZE);
+    counters.writes++;
+
+    if (dirty.size() >= max_dirty) {
+	flush();
+    }
+}
+
+void file_stream::append(unsigned int block, const void *buf)
+{
+    assert(!is_inline_inode(inode) && data_blocks.size() < FS_MAXFILEBLOCKS);
+
+    data_blocks.push_back(block);
+    write(data_blocks.size() - 1, buf);
+}
+
+void file_stream::flush()
+{
+    if (dirty.empty()) {
+	return;
+    }
+
+    std::vector<unsigned int>  blocks;
+    std::vector<const void *>  bufs;
+    for (auto &d : dirty) {
+	blocks.push_back(data_blocks[d.first]);
+	bufs.push_back(d.second.data());
+
+	// Reads look in dirty first, so only now do the windows that
+	// were read before the write need to catch up
+	window *w = find(d.first);
+	if (w) {
+	    w->ready.wait();
+	    memcpy(&w->data[(d.first - w->first) * FS_BLOCKSIZE],
+		   d.second.data(), FS_BLOCKSIZE);
+	}
+    }
+
+    disk.writeblocks(blocks.data(), bufs.data(), blocks.size());
+    counters.requests++;
+    dirty.clear();
+}
+
+const std::vector<uint32_t> &file_stream::blocks() const
+{
+    return data_blocks;
+}
+
+file_stream::stats_t file_stream::stats() const
+{
+    return counters;
+}
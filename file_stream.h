@@ -0,0 +1,101 @@
+/*
+ * file_stream.h
+ *
+ * Read-ahead and write-behind for the data blocks of one open file.
+ *
+ * Reads watch for sequential access: once a read is for the block after
+ * the previous one, the next blocks of the file are fetched ahead with
+ * one vectored readblocks on a helper thread, in windows that start at
+ * 4 blocks and double up to max_window.  A new window is started as
+ * soon as the reader enters the last one, so the disk stays busy while
+ * the reader works through what has arrived.  A read anywhere else
+ * drops the windows and goes straight to the disk.
+ *
+ * Writes are kept in memory, and reach the disk together with one
+ * vectored writeblocks when max_dirty blocks have piled up or on
+ * flush().  New data blocks must be on the disk before the inode that
+ * names them, so callers flush before writing the inode.
+ *
+ * A file_stream is not thread safe: callers must hold the file's lock,
+ * as they already must to read or change it.
+ */
+
+#ifndef _FILE_STREAM_H_
+#define _FILE_STREAM_H_
+
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
+#include <vector>
+
+#include "block_device.h"
+
+class file_stream {
+public:
+    struct stats_t {
+	uint64_t reads = 0;            // blocks read by the caller
+	uint64_t prefetched = 0;       // blocks read ahead
+	uint64_t writes = 0;           // blocks written by the caller
+	uint64_t requests = 0;         // requests issued to the disk
+    };
+
+    // REQUIRES: inode is a file inode (in any format), max_dirty > 0,
+    //           disk has FS_BLOCKSIZE byte blocks
+    // EFFECTS: opens the file for reading and writing through disk
+    file_stream(block_device &disk, const fs_inode &inode,
+		unsigned int max_window = 32, unsigned int max_dirty = 32);
+
+    // EFFECTS: flushes
+    ~file_stream();
+
+    // EFFECTS: returns the size of the file in blocks
+    unsigned int size() const;
+
+    // REQUIRES: index < size()
+    // EFFECTS: reads block index of the file into buf
+    void read(unsigned int index, void *buf);
+
+    // REQUIRES: index < size(), the file is not inline
+    // EFFECTS: replaces block index of the file with buf
+    void write(unsigned int index, const void *buf);
+
+    // REQUIRES: block is free, the file is not inline and has fewer than
+    //           FS_MAXFILEBLOCKS blocks
+    // EFFECTS: adds block holding buf as the last block of the file
+    void append(unsigned int block, const void *buf);
+
+    // EFFECTS: writes every buffered block to the disk
+    void flush();
+
+    // EFFECTS: returns the data blocks of the file in order, for the
+    //          inode
+    const std::vector<uint32_t> &blocks() const;
+
+    stats_t stats() const;
+
+private:
+    struct window {
+	unsigned int       first;      // index of the first block
+	unsigned int       count;
+	std::vector<char>  data;
+	std::future<void>  ready;
+    };
+
+    block_device                            &disk;
+    const fs_inode                           inode;
+    std::vector<uint32_t>                    data_blocks;
+    const unsigned int                       max_window;
+    const unsigned int                       max_dirty;
+
+    unsigned int                             next = 0;   // if sequential
+    unsigned int                             ahead = 0;  // window size
+    std::deque<window>                       windows;
+    std::map<unsigned int, std::vector<char>> dirty;     // index->data
+    stats_t                                  counters;
+
+    window *find(unsigned int index);
+    void prefetch(unsigned int first);
+};
+
+#endif /* _FILE_STREAM_H_ */
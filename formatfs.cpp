@@ -0,0 +1,219 @@
+#include "superblock.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "block_device.h"
+#include "fs_dump.h"
+
+// Format an empty file system (a root directory and a superblock) with
+// the given geometry.  The tools built on block_device work with any
+// number of blocks.  The disk backends work with any block size too,
+// but only scanfs reads file systems with blocks of other than
+// FS_BLOCKSIZE bytes; the other tools refuse them.  -j reserves that
+// many blocks below the superblock for the metadata journal of
+// journal.h.
+//
+// With -r, the image is instead restored from a binary dump written by
+// dumpfs (see fs_dump.h), with its geometry.  A dump file of "-" is
+// standard input.
+//
+//     usage: formatfs [-b block size] [-n disk blocks] [-j journal blocks]
+//                     [path]
+//            formatfs -r dumpfile [path]
+//
+// path defaults to the disk of libfs_server.o, /tmp/fs_tmp.$USER.disk.
+
+template <unsigned int BlockSize>
+void format(int fd, const fs_geometry &g)
+// EFFECTS: writes the root inode and the superblock of g to fd
+{
+    using layout = fs_format<BlockSize>;
+
+    std::unique_ptr<typename layout::inode> root(new typename layout::inode);
+    memset(root.get(), 0, sizeof(*root));
+    root->type = 'd';
+
+    ssize_t n = pwrite(fd, root.get(), sizeof(*root), 0);
+    assert(n == ssize_t(sizeof(*root)));
+    write_superblock(fd, g);
+
+    std::cout << g.disk_blocks << " blocks of " << BlockSize << " bytes ("
+	      << (uint64_t(g.disk_blocks) * BlockSize >> 20) << " MB), "
+	      << layout::max_file_blocks << " blocks per file, "
+	      << layout::direntries << " entries per directory block, "
+	      << g.journal_blocks << " journal blocks, "
+	      << g.disk_blocks - 2 - g.journal_blocks << " blocks free\n";
+}
+
+int restore(const char *dump, const std::string &path)
+// EFFECTS: restores the image at path from dump, returning the exit
+//          status
+{
+    auto  start = std::chrono::steady_clock::now();
+    bool  from_stdin = !strcmp(dump, "-");
+    FILE *in = from_stdin ? stdin : fopen(dump, "rb");
+    if (!in) {
+	perror(dump);
+	return 1;
+    }
+    static char buffer[1 << 20];
+    setvbuf(in, buffer, _IOFBF, sizeof(buffer));
+
+    fs_dump_header h;
+    if (fread(&h, sizeof(h), 1, in) != 1 ||
+	memcmp(h.magic, fs_dump_magic, sizeof(h.magic)) || h.version != 1 ||
+	h.block_size < FS_MIN_BLOCKSIZE || h.block_size > FS_MAX_BLOCKSIZE ||
+	(h.block_size & (h.block_size - 1))) {
+	std::cerr << dump << ": not a dump\n";
+	return 1;
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	perror(path.c_str());
+	return 1;
+    }
+    int status = ftruncate(fd, off_t(h.disk_blocks) * h.block_size);
+    assert(status == 0);
+
+    // Copy each run through in pieces of about a megabyte
+    const unsigned int  chunk = std::max(1u, (1u << 20) / h.block_size);
+    std::vector<char>   data(size_t(chunk) * h.block_size);
+    unsigned int        restored = 0;
+    fs_dump_run         run;
+
+    while (true) {
+	if (fread(&run, sizeof(run), 1, in) != 1) {
+	    std::cerr << dump << ": truncated\n";
+	    return 1;
+	}
+	if (!run.count) {
+	    break;
+	}
+	if (uint64_t(run.start) + run.count > h.disk_blocks) {
+	    std::cerr << dump << ": run past the end of the disk\n";
+	    return 1;
+	}
+
+	for (unsigned int done = 0; done < run.count; done += chunk) {
+	    unsigned int n = std::min(chunk, run.count - done);
+	    if (fread(data.data(), h.block_size, n, in) != n) {
+		std::cerr << dump << ": truncated\n";
+		return 1;
+	    }
+	    ssize_t bytes = pwrite(fd, data.data(), size_t(n) * h.block_size,
+				   off_t(run.start + done) * h.block_size);
+	    assert(bytes == ssize_t(n) * h.block_size);
+	}
+	restored += run.count;
+    }
+
+    status = fsync(fd);
+    assert(status == 0);
+    close(fd);
+    if (!from_stdin) {
+	fclose(in);
+    }
+
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+    std::cout << path << ": " << restored << " of " << h.disk_blocks
+	      << " blocks of " << h.block_size << " bytes restored in "
+	      << elapsed.count() << " seconds\n";
+    if (restored != h.used_blocks) {
+	std::cerr << dump << ": " << restored << " blocks in the runs, but "
+		  << h.used_blocks << " in the header\n";
+	return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    fs_geometry g;
+    int         opt;
+    const char *dump = nullptr;
+
+    g.has_superblock = true;
+    while ((opt = getopt(argc, argv, "b:n:j:r:")) != -1) {
+	if (opt == 'b') {
+	    g.block_size = atoi(optarg);
+	} else if (opt == 'n') {
+	    g.disk_blocks = atoi(optarg);
+	} else if (opt == 'j') {
+	    g.journal_blocks = atoi(optarg);
+	} else if (opt == 'r') {
+	    dump = optarg;
+	} else {
+	    std::cerr << "usage: " << argv[0]
+		      << " [-b block size] [-n disk blocks]"
+		      << " [-j journal blocks] [path]\n"
+		      << "       " << argv[0] << " -r dumpfile [path]\n";
+	    return 1;
+	}
+    }
+
+    std::string path = optind < argc ? argv[optind] : fs_disk_path();
+
+    if (dump) {
+	return restore(dump, path);
+    }
+
+    if (g.block_size < FS_MIN_BLOCKSIZE || g.block_size > FS_MAX_BLOCKSIZE ||
+	(g.block_size & (g.block_size - 1))) {
+	std::cerr << "block size must be a power of two from "
+		  << FS_MIN_BLOCKSIZE << " to " << FS_MAX_BLOCKSIZE << "\n";
+	return 1;
+    }
+    if (g.disk_blocks < 2) {
+	std::cerr << "a disk needs at least 2 blocks\n";
+	return 1;
+    }
+    if (g.journal_blocks) {
+	// A header and a transaction of one block
+	if (g.journal_blocks < 4 || g.journal_blocks > g.disk_blocks - 2) {
+	    std::cerr << "a journal needs 4 to " << g.disk_blocks - 2
+		      << " blocks\n";
+	    return 1;
+	}
+	g.journal_start = g.superblock() - g.journal_blocks;
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	perror(path.c_str());
+	return 1;
+    }
+
+    // A sparse file: unwritten blocks read as zeros
+    int status = ftruncate(fd, off_t(g.disk_blocks) * g.block_size);
+    assert(status == 0);
+
+    std::cout << path << ": ";
+    switch (g.block_size) {
+    case 512:   format<512>(fd, g);   break;
+    case 1024:  format<1024>(fd, g);  break;
+    case 2048:  format<2048>(fd, g);  break;
+    case 4096:  format<4096>(fd, g);  break;
+    case 8192:  format<8192>(fd, g);  break;
+    case 16384: format<16384>(fd, g); break;
+    case 32768: format<32768>(fd, g); break;
+    case 65536: format<65536>(fd, g); break;
+    }
+
+    status = fsync(fd);
+    assert(status == 0);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "free_map.h"
+
+#include <cassert>
+
+free_map::free_map(unsigned int nblocks_)
+    : nblocks(nblocks_), nwords((nblocks_ + 63) / 64),
+      words(new std::atomic<uint64_t>[(nblocks_ + 63) / 64])
+{
+    clear();
+}
+
+void free_map::clear()
+// EFFECTS: marks every block free
+{
+    for (unsigned int w = 0; w < nwords; w++) {
+	words[w].store(0, std::memory_order_relaxed);
+    }
+
+    // The bits past the end of the disk are permanently "used"
+    if (nblocks % 64) {
+	words[nwords - 1].store(~uint64_t(0) << (nblocks % 64),
+				std::memory_order_relaxed);
+    }
+    nfree = nblocks;
+}
+
+tree_walk::stats_t free_map::build(block_device &disk, unsigned int nthreads)
+{
+    // Every inode accounts for itself, its data blocks and its indirect
+    // blocks.  reserve is atomic, so the walker threads can all update
+    // the map at once.
+    class marker : public tree_walk::visitor {
+	free_map &map;
+
+    public:
+	explicit marker(free_map &m) : map(m) {}
+
+	void inode(const std::string &, unsigned int block,
+		   const fs_inode &, const inode_map &blocks) override
+	{
+	    map.reserve(block);
+	    for (const fs_extent &e : blocks.extents) {
+		for (uint32_t b = 0; b < e.length; b++) {
+		    map.reserve(e.start + b);
+		}
+	    }
+	    for (uint32_t b : blocks.meta) {
+		map.reserve(b);
+	    }
+	}
+    };
+
+    fs_geometry g = disk.geometry();
+    assert(g.disk_blocks == nblocks);
+
+    clear();
+    if (g.has_superblock) {
+	reserve(g.superblock());
+    }
+    for (unsigned int i = 0; i < g.journal_blocks; i++) {
+	reserve(g.journal_start + i);
+    }
+
+    marker     mark(*this);
+    tree_walk  walk(disk, nthreads);
+    return walk.run(mark);
+}
+
+unsigned int free_map::allocate()
+{
+    // Where this thread last found a free block
+    thread_local unsigned int hint = 0;
+
+    if (!nfree.load(std::memory_order_relaxed)) {
+	return 0;
+    }
+
+    for (unsigned int n = 0; n < nwords; n++) {
+	unsigned int w = (hint + n) % nwords;
+	uint64_t     bits = words[w].load(std::memory_order_relaxed);
+
+	// Claim the lowest clear bit.  On a lost race, bits is reloaded
+	// and we try again in the same word.
+	while (~bits) {
+	    uint64_t bit = uint64_t(1) << __builtin_ctzll(~bits);
+	    if (words[w].compare_exchange_weak(bits, bits | bit,
+					       std::memory_order_acq_rel)) {
+		hint = w;
+		nfree--;
+		return w * 64 + __builtin_ctzll(bit);
+	    }
+	}
+    }
+
+    return 0;
+}
+
+void free_map::release(unsigned int block)
+{
+    assert(block < nblocks);
+
+    uint64_t bit = uint64_t(1) << (block % 64);
+    uint64_t old = words[block / 64].fetch_and(~bit, std::memory_order_release);
+    assert(old & bit);
+    nfree++;
+}
+
+void free_map::reserve(unsigned int block)
+{
+    assert(block < nblocks);
+
+    uint64_t bit = uint64_t(1) << (block % 64);
+    uint64_t old = words[block / 64].fetch_or(bit, std::memory_order_acq_rel);
+    assert(!(old & bit));
+    nfree--;
+}
+
+bool free_map::is_free(unsigned int block) const
+{
+    assert(block < nblocks);
+    uint64_t bits = words[block / 64].load(std::memory_order_acquire);
+    return !(bits & (uint64_t(1) << (block % 64)));
+}
+
+unsigned int free_map::free_count() const
+{
+    return nfree.load(std::memory_order_relaxed);
+}
+
+unsigned int free_map::size() const
+{
+    return nblocks;
+}
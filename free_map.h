@@ -0,0 +1,65 @@
+/*
+ * free_map.h
+ *
+ * An in-memory bitmap of used and free disk blocks, one bit per block.
+ * It is built once at startup by walking the file system tree from the
+ * root inode, and is then kept up to date by allocate and release.
+ *
+ * allocate claims a bit with an atomic compare-and-swap, so it never
+ * takes a lock.  Each thread remembers the bitmap word it last
+ * allocated from and starts its next search there, so threads mostly
+ * allocate from runs of blocks in different words (and cache lines)
+ * and an allocation is O(1) amortized.
+ */
+
+#ifndef _FREE_MAP_H_
+#define _FREE_MAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "block_device.h"
+#include "tree_walk.h"
+
+class free_map {
+public:
+    // EFFECTS: creates a map of nblocks blocks, all of them free
+    explicit free_map(unsigned int nblocks = FS_DISKSIZE);
+
+    // REQUIRES: no concurrent allocate/release, nthreads > 0, size()
+    //           is disk.geometry().disk_blocks
+    // MODIFIES: this
+    // EFFECTS: marks exactly the blocks used by the file system on disk
+    //          (every inode and data block reachable from the root inode
+    //          at block 0, and the superblock and journal if there are
+    //          any) as used, walking the tree with nthreads threads.
+    //          Returns the statistics of the walk.
+    tree_walk::stats_t build(block_device &disk, unsigned int nthreads = 1);
+
+    // EFFECTS: marks a free block as used and returns it, or returns 0
+    //          if the disk is full (block 0 always holds the root inode)
+    unsigned int allocate();
+
+    // REQUIRES: block is used
+    // EFFECTS: marks block as free
+    void release(unsigned int block);
+
+    // REQUIRES: block is free
+    // EFFECTS: marks block as used
+    void reserve(unsigned int block);
+
+    bool is_free(unsigned int block) const;
+    unsigned int free_count() const;
+    unsigned int size() const;
+
+private:
+    const unsigned int                       nblocks;
+    const unsigned int                       nwords;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;  // bit set: block used
+    std::atomic<unsigned int>                nfree;
+
+    void clear();
+};
+
+#endif /* _FREE_MAP_H_ */
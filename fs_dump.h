@@ -0,0 +1,37 @@
+/*
+ * fs_dump.h
+ *
+ * The binary dump format written by dumpfs and read back by
+ * formatfs -r: a header with the geometry of the image, then every used
+ * block of the image (as free_map sees it) in runs of consecutive
+ * blocks,
+ *
+ *     fs_dump_header
+ *     fs_dump_run, then run.count blocks of data    (repeated)
+ *     fs_dump_run with count 0
+ *
+ * so it can be written and read as one stream, with no parsing.  The
+ * free blocks are not in the dump and restore as zeros.
+ */
+
+#ifndef _FS_DUMP_H_
+#define _FS_DUMP_H_
+
+#include <cstdint>
+
+static const char fs_dump_magic[8] = "fs482dp";
+
+struct fs_dump_header {
+    char     magic[8];                     // fs_dump_magic
+    uint32_t version;                      // 1
+    uint32_t block_size;
+    uint32_t disk_blocks;
+    uint32_t used_blocks;                  // in all the runs
+};
+
+struct fs_dump_run {
+    uint32_t start;                        // first block
+    uint32_t count;                        // blocks, 0 at the end
+};
+
+#endif /* _FS_DUMP_H_ */
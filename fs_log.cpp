@@ -0,0 +1,381 @@
+#include "fs_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// A single-producer, single-consumer byte ring.  head and tail count
+// bytes ever written and drained; only the owning thread moves head,
+// only the drainer moves tail.
+struct ring {
+    alignas(64) std::atomic<std::size_t>  head{0};
+    std::size_t                           cached_tail = 0;   // producer's
+    alignas(64) std::atomic<std::size_t>  tail{0};
+    std::atomic<bool>                     closed{false};     // thread gone
+    char                                  data[fs_log::ring_size];
+};
+
+class drainer {
+    std::mutex                          m;           // rings, requests
+    std::condition_variable             wake;
+    std::condition_variable             drained;
+    std::vector<std::shared_ptr<ring>>  rings;
+    uint64_t                            requested = 0;   // flush requests
+    uint64_t                            completed = 0;   // ... served
+    bool                                stopping = false;
+
+    // Set (under m) while the drainer waits for work.  A logger checks
+    // it after publishing a line, and wakes the drainer if it is set.
+    std::atomic<bool>                   sleeping{false};
+
+    // The output, and the lock held around each write to it, so that
+    // writing never holds up the callers of m
+    std::mutex                          out_m;
+    int                                 fd = STDOUT_FILENO;
+
+    std::thread                         thread;
+
+    std::size_t drain(ring &r, char *batch, std::size_t used);
+    void output(const char *batch, std::size_t len);
+    void run();
+
+public:
+    static drainer &get()
+    {
+	static drainer d;
+	return d;
+    }
+
+    drainer();
+    ~drainer();
+
+    ring &local();
+    bool asleep() const;
+    void kick();
+    void flush();
+    bool open(const char *path);
+    void write_direct(const char *data, std::size_t len);
+    bool stopped();
+};
+
+// Marks the thread's ring closed when the thread exits; the drainer
+// frees it once it is empty
+struct ring_owner {
+    std::shared_ptr<ring> r;
+
+    ~ring_owner()
+    {
+	if (r) {
+	    r->closed.store(true, std::memory_order_release);
+	}
+    }
+};
+
+const std::size_t batch_size = 1 << 16;
+
+drainer::drainer()
+    : thread(&drainer::run, this)
+{
+}
+
+drainer::~drainer()
+{
+    // At exit: write out what is left and stop
+    {
+	std::lock_guard<std::mutex> lock(m);
+	stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+ring &drainer::local()
+// EFFECTS: returns the calling thread's ring, registering it on first use
+{
+    thread_local ring_owner mine;
+
+    if (!mine.r) {
+	mine.r = std::make_shared<ring>();
+	std::lock_guard<std::mutex> lock(m);
+	rings.push_back(mine.r);
+    }
+    return *mine.r;
+}
+
+bool drainer::asleep() const
+// REQUIRES: the caller has just published a line with a seq_cst store
+{
+    return sleeping.load();
+}
+
+void drainer::kick()
+{
+    // Taking m orders this after the drainer either saw our line or
+    // started waiting, so the wakeup cannot be lost
+    {
+	std::lock_guard<std::mutex> lock(m);
+    }
+    wake.notify_one();
+}
+
+bool drainer::stopped()
+{
+    std::lock_guard<std::mutex> lock(m);
+    return stopping;
+}
+
+void drainer::write_direct(const char *data, std::size_t len)
+// EFFECTS: writes data straight to the output, for lines logged while
+//          the drainer is shutting down
+{
+    output(data, len);
+}
+
+std::size_t drainer::drain(ring &r, char *batch, std::size_t used)
+// REQUIRES: called from the drainer thread
+//
+// EFFECTS: moves the contents of r into batch (which holds used bytes),
+//          writing out the batch whenever it fills up.  Returns the
+//          number of bytes now in batch.
+{
+    std::size_t head = r.head.load(std::memory_order_acquire);
+    std::size_t tail = r.tail.load(std::memory_order_relaxed);
+
+    while (tail != head) {
+	std::size_t offset = tail % fs_log::ring_size;
+	std::size_t len = std::min({head - tail, fs_log::ring_size - offset,
+				    batch_size - used});
+
+	memcpy(batch + used, r.data + offset, len);
+	used += len;
+	tail += len;
+
+	// Hand the space back as soon as it is copied
+	r.tail.store(tail, std::memory_order_release);
+
+	if (used == batch_size) {
+	    output(batch, used);
+	    used = 0;
+	}
+    }
+    return used;
+}
+
+void drainer::output(const char *batch, std::size_t len)
+{
+    std::lock_guard<std::mutex> lock(out_m);
+
+    while (len > 0) {
+	ssize_t n = ::write(fd, batch, len);
+	if (n < 0) {
+	    // Nowhere to report it; give up on this batch
+	    return;
+	}
+	batch += n;
+	len -= n;
+    }
+}
+
+void drainer::run()
+{
+    std::unique_ptr<char[]> batch(new char[batch_size]);
+    std::unique_lock<std::mutex> lock(m);
+
+    std::vector<std::shared_ptr<ring>> mine, done;
+
+    // EFFECTS: returns whether some ring holds lines not yet drained
+    auto pending = [&] {
+	for (auto &r : rings) {
+	    if (r->tail.load(std::memory_order_relaxed) != r->head.load()) {
+		return true;
+	    }
+	}
+	return false;
+    };
+
+    while (true) {
+	// Every line queued before a flush request was made is in a ring
+	// by the time we read the request number here
+	uint64_t serving = requested;
+	bool     stop = stopping;
+
+	// Drain a copy of the list without m, so that new threads can
+	// register meanwhile
+	mine = rings;
+	lock.unlock();
+
+	std::size_t used = 0;
+	for (auto &r : mine) {
+	    bool closed = r->closed.load(std::memory_order_acquire);
+
+	    used = drain(*r, batch.get(), used);
+	    if (closed && r->tail.load(std::memory_order_relaxed) ==
+		r->head.load(std::memory_order_acquire)) {
+		done.push_back(r);
+	    }
+	}
+	output(batch.get(), used);
+	mine.clear();
+
+	lock.lock();
+	for (auto &r : done) {
+	    rings.erase(std::find(rings.begin(), rings.end(), r));
+	}
+	done.clear();
+
+	if (serving != completed) {
+	    completed = serving;
+	    drained.notify_all();
+	}
+	if (stop) {
+	    return;
+	}
+
+	// Sleep until a logger, a flush or the destructor wakes us.  The
+	// flag is set before the rings are checked, so a line published
+	// after the check finds it set and kicks us.
+	sleeping.store(true);
+	while (!pending() && requested == serving && !stopping) {
+	    wake.wait(lock);
+	}
+	sleeping.store(false);
+    }
+}
+
+void drainer::flush()
+{
+    std::unique_lock<std::mutex> lock(m);
+    if (stopping) {
+	return;
+    }
+
+    uint64_t mine = ++requested;
+    wake.notify_one();
+    drained.wait(lock, [&] { return completed >= mine; });
+}
+
+bool drainer::open(const char *path)
+{
+    int newfd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (newfd < 0) {
+	return false;
+    }
+
+    flush();
+
+    std::lock_guard<std::mutex> lock(out_m);
+    if (fd != STDOUT_FILENO) {
+	::close(fd);
+    }
+    fd = newfd;
+    return true;
+}
+
+} // namespace
+
+bool fs_log::open(const char *path)
+{
+    return drainer::get().open(path);
+}
+
+void fs_log::write(const char *data, std::size_t len)
+{
+    assert(len <= max_line);
+
+    drainer &d = drainer::get();
+    ring    &r = d.local();
+    std::size_t head = r.head.load(std::memory_order_relaxed);
+
+    // Wait for room; the tail only moves forward
+    while (ring_size - (head - r.cached_tail) < len) {
+	r.cached_tail = r.tail.load(std::memory_order_acquire);
+	if (ring_size - (head - r.cached_tail) >= len) {
+	    break;
+	}
+	if (d.stopped()) {
+	    d.write_direct(data, len);
+	    return;
+	}
+	d.kick();
+	std::this_thread::yield();
+    }
+
+    // Copy in (in two pieces if the line wraps around) and publish
+    std::size_t offset = head % ring_size;
+    std::size_t first = std::min(len, ring_size - offset);
+    memcpy(r.data + offset, data, first);
+    memcpy(r.data, data + first, len - first);
+    r.head.store(head + len);
+
+    if (d.asleep()) {
+	d.kick();
+    }
+}
+
+void fs_log::flush()
+{
+    drainer::get().flush();
+}
+
+log_line_buffer::log_line_buffer()
+{
+    // Leave room for the newline
+    setp(data, data + fs_log::max_line - 1);
+}
+
+void log_line_buffer::finish()
+{
+    std::size_t len = pptr() - pbase();
+    data[len++] = '\n';
+    fs_log::write(data, len);
+    setp(data, data + fs_log::max_line - 1);
+}
+
+log_stream::log_stream()
+    : std::ostream(this)
+{
+}
+
+void log_stream::finish()
+{
+    log_line_buffer::finish();
+
+    // Undo what the line may have set (badbit if it was cut short,
+    // manipulators), so the next line starts out like a new stream
+    clear();
+    flags(std::ios_base::dec | std::ios_base::skipws);
+    width(0);
+    precision(6);
+    fill(' ');
+}
+
+log_line::log_line()
+{
+    thread_local log_stream mine;
+
+    // A value being logged may log something itself
+    if (mine.busy) {
+	nested.reset(new log_stream);
+	stream = nested.get();
+    } else {
+	stream = &mine;
+    }
+    stream->busy = true;
+}
+
+log_line::~log_line()
+{
+    stream->finish();
+    stream->busy = false;
+}
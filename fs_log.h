@@ -0,0 +1,121 @@
+/*
+ * fs_log.h
+ *
+ * Asynchronous logging, as a replacement for printing to std::cout under
+ * cout_lock.
+ *
+ *     FS_LOG(log_info) << "created " << path << " at block " << block;
+ *
+ * Each statement formats one line (a newline is added) on the calling
+ * thread and copies it into that thread's ring buffer with a single
+ * memcpy: no locks and no system calls.  A background thread drains
+ * the rings in batches to stdout, or to the file given to
+ * fs_log::open, and sleeps while they are all empty; only the line that
+ * finds it asleep takes a lock, to wake it.  The lines of one thread come out in the order it
+ * logged them, as they did under cout_lock; lines of different threads
+ * are never mixed within a line, but otherwise interleave freely.  If a
+ * ring is full the logging thread waits for the drainer, so nothing is
+ * lost.
+ *
+ * Levels below FS_LOG_LEVEL (default log_debug, i.e. everything) are
+ * compiled out, arguments and all: build with -DFS_LOG_LEVEL=log_warning
+ * to drop debug and info lines.
+ *
+ * The log writes to the file descriptor directly.  Do not mix it with
+ * std::cout on the same output without fs_log::flush() in between.
+ */
+
+#ifndef _FS_LOG_H_
+#define _FS_LOG_H_
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+
+enum log_level { log_debug, log_info, log_warning, log_error };
+
+#ifndef FS_LOG_LEVEL
+#define FS_LOG_LEVEL log_debug
+#endif
+
+class fs_log {
+public:
+    // Longest line kept; longer ones are cut short
+    static const std::size_t max_line = 1024;
+
+    // Size in bytes of each thread's ring
+    static const std::size_t ring_size = 1 << 16;
+
+    // EFFECTS: appends the lines logged from now on to the file at path
+    //          (created if need be); all earlier lines are written to
+    //          the previous output first.  Returns false if the file
+    //          cannot be opened, leaving the output as it was.
+    static bool open(const char *path);
+
+    // REQUIRES: data holds len <= max_line bytes of whole lines
+    // EFFECTS: queues data for output
+    static void write(const char *data, std::size_t len);
+
+    // EFFECTS: returns once every line queued (by any thread) before the
+    //          call has been written out
+    static void flush();
+};
+
+// The fixed buffer of a log_stream; a base class so that it is
+// constructed before the std::ostream that writes into it
+class log_line_buffer : public std::streambuf {
+    char data[fs_log::max_line];
+
+protected:
+    log_line_buffer();
+
+    // EFFECTS: adds the newline, queues the line and empties the buffer
+    void finish();
+};
+
+// Formats one line at a time.  Each thread keeps one, since setting up
+// a std::ostream costs more than formatting a typical line.
+class log_stream : private log_line_buffer, public std::ostream {
+public:
+    bool busy = false;                  // a log_line is using it
+
+    log_stream();
+
+    // EFFECTS: queues the line and resets the stream for the next one
+    void finish();
+};
+
+// One log line: collects what is streamed into it and queues it when
+// destroyed
+class log_line {
+    log_stream                   *stream;
+    std::unique_ptr<log_stream>   nested;    // if the thread's was busy
+
+public:
+    log_line();
+    ~log_line();
+
+    log_line(const log_line &) = delete;
+    log_line &operator=(const log_line &) = delete;
+
+    template <typename T>
+    log_line &operator<<(const T &value)
+    {
+	*stream << value;
+	return *this;
+    }
+
+    log_line &operator<<(std::ostream &(*manipulator)(std::ostream &))
+    {
+	manipulator(*stream);
+	return *this;
+    }
+};
+
+#define FS_LOG(level)                                                   \
+    if constexpr ((level) < FS_LOG_LEVEL) {                             \
+    } else                                                              \
+	log_line()
+
+#endif /* _FS_LOG_H_ */
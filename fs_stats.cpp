@@ -0,0 +1,182 @@
+#include "fs_stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
+namespace {
+
+const char *const counter_names[fs_counters] = {
+    "disk blocks read",
+    "disk blocks written",
+    "cache hits",
+    "cache misses",
+    "lock acquires",
+    "lock acquires contended",
+    "requests",
+};
+
+const char *const timing_names[fs_timings] = {
+    "disk read",
+    "disk write",
+    "lock wait",
+    "cout_lock wait",
+    "request",
+    "  lookup",
+    "  update",
+};
+
+// The totals of one timing over all threads
+struct totals {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t buckets[fs_stats::buckets] = {};
+
+    // EFFECTS: returns the largest value that falls in the bucket of the
+    //          p-th percentile (at most the maximum)
+    uint64_t percentile(double p) const
+    {
+	uint64_t rank = p * count;
+	uint64_t seen = 0;
+
+	for (unsigned int b = 0; b < fs_stats::buckets; b++) {
+	    seen += buckets[b];
+	    if (seen > rank) {
+		return std::min(max, highest(b));
+	    }
+	}
+	return max;
+    }
+
+    static uint64_t highest(unsigned int b)
+    {
+	const unsigned int sub = fs_stats::sub_buckets;
+	if (b < sub) {
+	    return b;
+	}
+	unsigned int e = b / sub + 2;
+	uint64_t low = uint64_t(sub + b % sub) << (e - 3);
+	return low + (uint64_t(1) << (e - 3)) - 1;
+    }
+};
+
+int signal_pipe[2] = {-1, -1};
+
+void on_signal(int)
+{
+    // Only async-signal-safe calls here: wake the dumping thread
+    int saved = errno;
+    char c = 0;
+    ssize_t n = write(signal_pipe[1], &c, 1);
+    (void) n;
+    errno = saved;
+}
+
+void dump_thread()
+{
+    while (true) {
+	char c;
+	ssize_t n = read(signal_pipe[0], &c, 1);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	assert(n == 1);
+
+	std::ostringstream os;
+	fs_stats::dump(os);
+
+	// One write, so the dump is not mixed with other output lines
+	std::string s = os.str();
+	n = write(STDERR_FILENO, s.data(), s.size());
+	(void) n;
+    }
+}
+
+} // namespace
+
+void fs_stats::dump(std::ostream &os)
+{
+    uint64_t counters[fs_counters] = {};
+    std::unique_ptr<totals[]> timings(new totals[fs_timings]);
+    unsigned int threads, exited;
+
+    // The threads keep recording, so the buckets of a timing may add up
+    // to a few more values than its count
+    {
+	std::lock_guard<std::mutex> lock(registry_lock);
+	threads = registry.size();
+	exited = retired_threads;
+
+	std::vector<const slab *> all(registry.begin(), registry.end());
+	all.push_back(&retired());
+
+	for (const slab *s : all) {
+	    for (unsigned int c = 0; c < fs_counters; c++) {
+		counters[c] += s->counters[c].load(std::memory_order_relaxed);
+	    }
+	    for (unsigned int t = 0; t < fs_timings; t++) {
+		const slab::histogram &h = s->timings[t];
+		totals &total = timings[t];
+
+		total.count += h.count.load(std::memory_order_relaxed);
+		total.sum += h.sum.load(std::memory_order_relaxed);
+		total.max = std::max(total.max,
+				     h.max.load(std::memory_order_relaxed));
+		for (unsigned int b = 0; b < fs_stats::buckets; b++) {
+		    total.buckets[b] +=
+			h.buckets[b].load(std::memory_order_relaxed);
+		}
+	    }
+	}
+    }
+
+    char line[128];
+    os << "stats (threads: " << threads << " running, " << exited
+       << " exited)\n";
+    for (unsigned int c = 0; c < fs_counters; c++) {
+	snprintf(line, sizeof(line), "  %-24s %12llu\n", counter_names[c],
+		 static_cast<unsigned long long>(counters[c]));
+	os << line;
+    }
+
+    os << "  latency (ns)          count      mean       p50       p99"
+	  "     p99.9       max\n";
+    for (unsigned int t = 0; t < fs_timings; t++) {
+	const totals &total = timings[t];
+	if (!total.count) {
+	    continue;
+	}
+
+	snprintf(line, sizeof(line),
+		 "  %-16s %10llu %9.0f %9llu %9llu %9llu %9llu\n",
+		 timing_names[t], static_cast<unsigned long long>(total.count),
+		 double(total.sum) / total.count,
+		 static_cast<unsigned long long>(total.percentile(0.5)),
+		 static_cast<unsigned long long>(total.percentile(0.99)),
+		 static_cast<unsigned long long>(total.percentile(0.999)),
+		 static_cast<unsigned long long>(total.max));
+	os << line;
+    }
+}
+
+void fs_stats::dump_on_signal(int sig)
+{
+    assert(signal_pipe[0] < 0);
+
+    int status = pipe(signal_pipe);
+    assert(status == 0);
+    std::thread(dump_thread).detach();
+
+    struct sigaction action = {};
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    status = sigaction(sig, &action, nullptr);
+    assert(status == 0);
+}
@@ -0,0 +1,295 @@
+/*
+ * fs_stats.h
+ *
+ * Hot-path counters and latency histograms, for finding out where slow
+ * requests spend their time without stopping the server:
+ *
+ *     FS_COUNT(count_cache_hits);
+ *     FS_COUNT_N(count_disk_blocks_read, n);
+ *     FS_RECORD(time_lock_wait, wait_ns);
+ *     {
+ *         FS_TIME(time_request_lookup);      // times the enclosing scope
+ *         ...
+ *     }
+ *
+ * Every thread records into a slab of its own, so an event is a plain
+ * load and store of a thread-local counter (about a nanosecond); timed
+ * scopes also read the clock twice.  fs_stats::dump adds up the slabs
+ * of all threads, including threads that have exited, while they keep
+ * recording, and prints the counters and the count, mean, percentiles
+ * and maximum of each timing.  fs_stats::dump_on_signal makes a signal
+ * (SIGUSR1 by default) dump to standard error.
+ *
+ * The histograms are HDR style: 8 linear buckets for each power of two
+ * from 8ns up, so percentiles are within 12.5% of the true value for
+ * any latency.
+ *
+ * Build with -DFS_STATS=0 to compile every macro out, arguments and
+ * all.  The slabs are only set up by the macros, so a program that
+ * never dumps does not need fs_stats.o.
+ */
+
+#ifndef _FS_STATS_H_
+#define _FS_STATS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#ifndef FS_STATS
+#define FS_STATS 1
+#endif
+
+// Events, counted; see the names in fs_stats.cpp
+enum fs_counter {
+    count_disk_blocks_read,
+    count_disk_blocks_written,
+    count_cache_hits,
+    count_cache_misses,
+    count_lock_acquires,
+    count_lock_contended,
+    count_requests,
+    fs_counters
+};
+
+// Latencies, in ns: each disk call (vectored ones included), each
+// contended lock acquire, and each request and its phases
+enum fs_timing {
+    time_disk_read,
+    time_disk_write,
+    time_lock_wait,
+    time_cout_lock_wait,
+    time_request,
+    time_request_lookup,
+    time_request_update,
+    fs_timings
+};
+
+class fs_stats {
+public:
+    // Bucket b of a histogram holds the values v with bucket(v) == b
+    static const unsigned int sub_buckets = 8;
+    static const unsigned int buckets = (64 - 2) * sub_buckets;
+
+    static unsigned int bucket(uint64_t v)
+    {
+	if (v < sub_buckets) {
+	    return v;
+	}
+	unsigned int e = 63 - __builtin_clzll(v);             // e >= 3
+	return (e - 2) * sub_buckets + ((v >> (e - 3)) & (sub_buckets - 1));
+    }
+
+    // One thread's events.  Only the thread writes them; a dump may read
+    // them at any time, hence the (relaxed) atomics.
+    struct slab {
+	struct histogram {
+	    std::atomic<uint64_t> count{0};
+	    std::atomic<uint64_t> sum{0};
+	    std::atomic<uint64_t> max{0};
+	    std::atomic<uint64_t> buckets[fs_stats::buckets] = {};
+	};
+
+	std::atomic<uint64_t> counters[fs_counters] = {};
+	histogram timings[fs_timings];
+    };
+
+    // EFFECTS: returns the calling thread's slab, or nullptr once the
+    //          thread is exiting and its slab has been retired (events
+    //          from later thread_local destructors are dropped)
+    static slab *local()
+    {
+	if (!mine && !exited) {
+	    mine = new_slab();
+	}
+	return mine;
+    }
+
+    static void count(fs_counter c, uint64_t n = 1)
+    {
+	slab *s = local();
+	if (s) {
+	    add(s->counters[c], n);
+	}
+    }
+
+    static void record(fs_timing t, uint64_t ns)
+    {
+	slab *s = local();
+	if (!s) {
+	    return;
+	}
+	slab::histogram &h = s->timings[t];
+	add(h.count, 1);
+	add(h.sum, ns);
+	add(h.buckets[bucket(ns)], 1);
+	if (ns > h.max.load(std::memory_order_relaxed)) {
+	    h.max.store(ns, std::memory_order_relaxed);
+	}
+    }
+
+    static uint64_t now()
+    {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Records the time from its construction to its destruction
+    class timer {
+	const fs_timing t;
+	const uint64_t  start;
+
+    public:
+	explicit timer(fs_timing t_) : t(t_), start(now()) {}
+	~timer() { record(t, now() - start); }
+
+	timer(const timer &) = delete;
+	timer &operator=(const timer &) = delete;
+    };
+
+    // EFFECTS: prints the totals of all threads' slabs
+    static void dump(std::ostream &os);
+
+    // REQUIRES: called at most once
+    // EFFECTS: dumps to standard error whenever the process receives sig
+    //          from now on
+    static void dump_on_signal(int sig = SIGUSR1);
+
+private:
+    // The slabs of the running threads.  When a thread exits its slab is
+    // added into retired and freed, so a dump still sees its events but
+    // the memory does not grow with every thread ever started.
+    static inline std::mutex            registry_lock;
+    static inline std::vector<slab *>   registry;
+    static inline unsigned int          retired_threads = 0;
+
+    static slab &retired()
+    {
+	static slab totals;
+	return totals;
+    }
+
+    // The calling thread's slab, and whether it has been retired.  Both
+    // are trivially destructible, so they stay valid while the other
+    // thread_local destructors run.
+    static inline thread_local slab *mine = nullptr;
+    static inline thread_local bool  exited = false;
+
+    // Retires the thread's slab when the thread exits
+    struct owner {
+	~owner()
+	{
+	    if (mine) {
+		retire(mine);
+		mine = nullptr;
+	    }
+	    exited = true;
+	}
+    };
+
+    static slab *new_slab()
+    {
+	thread_local owner retirer;
+	slab *s = new slab;
+
+	std::lock_guard<std::mutex> lock(registry_lock);
+	registry.push_back(s);
+	return s;
+    }
+
+    static void retire(slab *s)
+    {
+	std::lock_guard<std::mutex> lock(registry_lock);
+	merge(retired(), *s);
+	retired_threads++;
+	registry.erase(std::find(registry.begin(), registry.end(), s));
+	delete s;
+    }
+
+    // REQUIRES: registry_lock is held, and only the caller writes into
+    // EFFECTS: adds the events of from to into
+    static void merge(slab &into, const slab &from)
+    {
+	for (unsigned int c = 0; c < fs_counters; c++) {
+	    add(into.counters[c],
+		from.counters[c].load(std::memory_order_relaxed));
+	}
+	for (unsigned int t = 0; t < fs_timings; t++) {
+	    slab::histogram &to = into.timings[t];
+	    const slab::histogram &h = from.timings[t];
+
+	    add(to.count, h.count.load(std::memory_order_relaxed));
+	    add(to.sum, h.sum.load(std::memory_order_relaxed));
+	    to.max.store(std::max(to.max.load(std::memory_order_relaxed),
+				  h.max.load(std::memory_order_relaxed)),
+			 std::memory_order_relaxed);
+	    for (unsigned int b = 0; b < buckets; b++) {
+		add(to.buckets[b],
+		    h.buckets[b].load(std::memory_order_relaxed));
+	    }
+	}
+    }
+
+    // Only the owning thread writes, so no atomic read-modify-write
+    static void add(std::atomic<uint64_t> &a, uint64_t n)
+    {
+	a.store(a.load(std::memory_order_relaxed) + n,
+		std::memory_order_relaxed);
+    }
+};
+
+// A std::lock_guard that records how long it had to wait for the lock,
+// for locks that are not instrumented_mutexes (e.g. cout_lock):
+//
+//     stats_lock_guard<std::mutex> lock(cout_lock, time_cout_lock_wait);
+template <typename Mutex>
+class stats_lock_guard {
+    Mutex &m;
+
+public:
+    stats_lock_guard(Mutex &m_, fs_timing t)
+	: m(m_)
+    {
+#if FS_STATS
+	if (m.try_lock()) {
+	    return;
+	}
+	uint64_t start = fs_stats::now();
+	m.lock();
+	fs_stats::record(t, fs_stats::now() - start);
+#else
+	m.lock();
+#endif
+    }
+
+    ~stats_lock_guard()
+    {
+	m.unlock();
+    }
+
+    stats_lock_guard(const stats_lock_guard &) = delete;
+    stats_lock_guard &operator=(const stats_lock_guard &) = delete;
+};
+
+#define FS_STATS_CONCAT(a, b) a##b
+#define FS_STATS_NAME(line) FS_STATS_CONCAT(fs_stats_timer_, line)
+
+#if FS_STATS
+#define FS_COUNT(c) fs_stats::count(c)
+#define FS_COUNT_N(c, n) fs_stats::count(c, n)
+#define FS_RECORD(t, ns) fs_stats::record(t, ns)
+#define FS_TIME(t) fs_stats::timer FS_STATS_NAME(__LINE__)(t)
+#else
+#define FS_COUNT(c) ((void) 0)
+#define FS_COUNT_N(c, n) ((void) 0)
+#define FS_RECORD(t, ns) ((void) 0)
+#define FS_TIME(t) ((void) 0)
+#endif
+
+#endif /* _FS_STATS_H_ */
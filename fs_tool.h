@@ -0,0 +1,33 @@
+/*
+ * fs_tool.h
+ *
+ * Checks shared by the command line tools that read a disk image.
+ *
+ * Most of the tools use the structures of fs_server.h (fs_inode and
+ * fs_direntry blocks), which only describe FS_BLOCKSIZE byte blocks.
+ * They refuse an image with any other block size (see formatfs -b) up
+ * front, instead of asserting deep inside a walk of it.
+ */
+
+#ifndef _FS_TOOL_H_
+#define _FS_TOOL_H_
+
+#include <iostream>
+
+#include "block_device.h"
+
+// EFFECTS: returns whether the blocks of disk are FS_BLOCKSIZE bytes.  If
+//          not, tells the user on std::cerr that program cannot read it.
+inline bool fs_blocksize_disk(const block_device &disk, const char *program)
+{
+    unsigned int block_size = disk.geometry().block_size;
+    if (block_size == FS_BLOCKSIZE) {
+	return true;
+    }
+    std::cerr << program << ": the disk has blocks of " << block_size
+	      << " bytes; only " << FS_BLOCKSIZE << " byte blocks are"
+	      << " supported\n";
+    return false;
+}
+
+#endif /* _FS_TOOL_H_ */
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "dentry_cache.h"
+#include "dir_index.h"
+#include "dynamic_map.h"
+#include "hoh_list.h"
+#include "instrumented_mutex.h"
+#include "lock_table.h"
+#include "striped_disk.h"
+
+// The benchmark suite run by "make bench": every case runs for a fixed
+// time from fixed random seeds against a fresh scratch image, and the
+// results come out on standard output as one JSON document, with the
+// throughput and latency percentiles of each case:
+//
+//     disk.{read,write}.{random,sequential}  striped_disk, 1..N threads
+//     dir.lookup.{hit,miss}, dir.create      a directory of
+//                                            FS_MAXFILEBLOCKS blocks at
+//                                            25/50/90% full, by linear
+//                                            scan and with dir_index
+//     hoh.lookup                             hand-over-hand and
+//                                            optimistic, 1..N threads
+//     map.lookup                             dynamic_map with half the
+//                                            names alive, 1..N threads
+//     path.lock                              lock_table::lock_path of an
+//                                            exclusive file lock,
+//                                            1..N threads
+//     path.resolve                           dentry_cache, a quarter of
+//                                            the paths absent,
+//                                            1..N threads
+//
+//     usage: fsbench [max threads] [seconds per case]
+
+using clock_type = std::chrono::steady_clock;
+
+// One case: its parameters, and the latency of every operation
+struct result {
+    using named = std::vector<std::pair<std::string, std::string>>;
+
+    std::string                                   name;
+    named                                         params;
+    double                                        seconds = 0;   // run time
+    std::vector<uint32_t>                         ns;
+    std::vector<std::pair<std::string, double>>   extra;      // measured
+};
+
+// Runs op(thread, rng) from nthreads threads for the given time, timing
+// each call
+result timed(const std::string &name, unsigned int nthreads, double seconds,
+	     const std::function<void(unsigned int, std::mt19937 &)> &op)
+{
+    std::atomic<bool>                   stop(false);
+    std::vector<std::vector<uint32_t>>  samples(nthreads);
+    std::vector<std::thread>            threads;
+
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([&, t] {
+	    std::mt19937 rng(t + 1);
+	    std::vector<uint32_t> &mine = samples[t];
+
+	    while (!stop.load(std::memory_order_relaxed)) {
+		auto start = clock_type::now();
+		op(t, rng);
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		    clock_type::now() - start).count();
+		mine.push_back(std::min<int64_t>(ns, UINT32_MAX));
+	    }
+	});
+    }
+
+    auto start = clock_type::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &thread : threads) {
+	thread.join();
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    result r;
+    r.name = name;
+    r.params.emplace_back("threads", std::to_string(nthreads));
+    r.seconds = elapsed.count();
+    for (auto &s : samples) {
+	r.ns.insert(r.ns.end(), s.begin(), s.end());
+    }
+    return r;
+}
+
+// Prints r as a JSON object
+void print(const result &r, bool last)
+{
+    std::vector<uint32_t> ns = r.ns;
+    std::sort(ns.begin(), ns.end());
+
+    auto percentile = [&](double p) -> uint32_t {
+	if (ns.empty()) {
+	    return 0;
+	}
+	std::size_t i = std::min(ns.size() - 1, std::size_t(p * ns.size()));
+	return ns[i];
+    };
+    double mean = 0;
+    for (uint32_t n : ns) {
+	mean += n;
+    }
+    mean = ns.empty() ? 0 : mean / ns.size();
+
+    printf("    {\"name\": \"%s\"", r.name.c_str());
+    for (auto &p : r.params) {
+	bool number = !p.second.empty() &&
+		      p.second.find_first_not_of("0123456789.") ==
+		      std::string::npos;
+	printf(number ? ", \"%s\": %s" : ", \"%s\": \"%s\"", p.first.c_str(),
+	       p.second.c_str());
+    }
+    printf(", \"ops\": %zu, \"ops_per_sec\": %.1f", ns.size(),
+	   ns.size() / r.seconds);
+    for (auto &e : r.extra) {
+	printf(", \"%s\": %.4f", e.first.c_str(), e.second);
+    }
+    printf(",\n     \"latency_ns\": {\"mean\": %.1f, \"p50\": %u, \"p90\": %u,"
+	   " \"p99\": %u, \"p999\": %u, \"max\": %u}}%s\n", mean,
+	   percentile(0.5), percentile(0.9), percentile(0.99),
+	   percentile(0.999), ns.empty() ? 0 : ns.back(), last ? "" : ",");
+}
+
+void disk_cases(std::vector<result> &results, const std::string &path,
+		unsigned int max_threads, double seconds)
+{
+    striped_disk disk(path);
+
+    for (bool write : {false, true}) {
+	for (bool sequential : {false, true}) {
+	    std::string name = std::string("disk.") +
+			       (write ? "write" : "read") +
+			       (sequential ? ".sequential" : ".random");
+
+	    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+		// Sequential threads each sweep a region of their own
+		unsigned int region = FS_DISKSIZE / n;
+		std::vector<unsigned int> next(n);
+		for (unsigned int t = 0; t < n; t++) {
+		    next[t] = t * region;
+		}
+
+		results.push_back(timed(name, n, seconds,
+		    [&](unsigned int t, std::mt19937 &rng) {
+			char buf[FS_BLOCKSIZE];
+			unsigned int block;
+			if (sequential) {
+			    block = next[t];
+			    next[t] = next[t] + 1 < (t + 1) * region
+				      ? next[t] + 1 : t * region;
+			} else {
+			    block = rng() % FS_DISKSIZE;
+			}
+			if (write) {
+			    memset(buf, t, sizeof(buf));
+			    disk.writeblock(block, buf);
+			} else {
+			    disk.readblock(block, buf);
+			}
+		    }));
+	    }
+	}
+    }
+}
+
+uint32_t scan(block_device &disk, const fs_inode &dir, const char *name,
+	      dir_index::location *free_slot)
+// EFFECTS: looks for name by reading every block of dir, the way a
+//          server without an index does, and returns its inode block (or
+//          0).  Sets *free_slot to the first unused slot, if asked.
+{
+    fs_direntry entries[FS_DIRENTRIES];
+    bool found_free = false;
+
+    for (unsigned int i = 0; i < dir.size; i++) {
+	disk.readblock(dir.blocks[i], entries);
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    if (!entries[j].inode_block) {
+		if (free_slot && !found_free) {
+		    *free_slot = {i, j};
+		    found_free = true;
+		}
+	    } else if (!strcmp(entries[j].name, name)) {
+		return entries[j].inode_block;
+	    }
+	}
+    }
+    return 0;
+}
+
+void set_entry(block_device &disk, const fs_inode &dir,
+	       dir_index::location where, const char *name, uint32_t inode)
+// EFFECTS: writes name and inode to the direntry slot where
+{
+    fs_direntry entries[FS_DIRENTRIES];
+    disk.readblock(dir.blocks[where.index], entries);
+    strcpy(entries[where.slot].name, name);
+    entries[where.slot].inode_block = inode;
+    disk.writeblock(dir.blocks[where.index], entries);
+}
+
+void dir_cases(std::vector<result> &results, const std::string &path,
+	       double seconds)
+{
+    striped_disk disk(path);
+
+    for (unsigned int fullness : {25, 50, 90}) {
+	// A directory with every slot up to fullness percent in use,
+	// spread evenly over its blocks
+	fs_inode dir;
+	memset(&dir, 0, sizeof(dir));
+	dir.type = 'd';
+	dir.size = FS_MAXFILEBLOCKS;
+
+	std::vector<std::string> present;
+	unsigned int used_slots = FS_DIRENTRIES * fullness / 100;
+
+	for (unsigned int i = 0; i < dir.size; i++) {
+	    fs_direntry entries[FS_DIRENTRIES];
+	    memset(entries, 0, sizeof(entries));
+	    dir.blocks[i] = 1000 + i;
+	    for (unsigned int j = 0; j < used_slots; j++) {
+		snprintf(entries[j].name, sizeof(entries[j].name),
+			 "file%05u.txt", i * FS_DIRENTRIES + j);
+		entries[j].inode_block = 3000 + (i * FS_DIRENTRIES + j) % 1000;
+		present.push_back(entries[j].name);
+	    }
+	    disk.writeblock(dir.blocks[i], entries);
+	}
+
+	dir_index index;
+	index.load(disk, dir);
+
+	std::string full = std::to_string(fullness);
+	auto add = [&](const char *method) {
+	    results.back().params.emplace_back("fullness", full);
+	    results.back().params.emplace_back("method", method);
+	};
+
+	for (bool indexed : {false, true}) {
+	    const char *method = indexed ? "dir_index" : "linear";
+
+	    results.push_back(timed("dir.lookup.hit", 1, seconds,
+		[&](unsigned int, std::mt19937 &rng) {
+		    const std::string &name = present[rng() % present.size()];
+		    uint32_t inode = indexed
+			? index.find(name)->inode_block
+			: scan(disk, dir, name.c_str(), nullptr);
+		    assert(inode);
+		}));
+	    add(method);
+
+	    results.push_back(timed("dir.lookup.miss", 1, seconds,
+		[&](unsigned int, std::mt19937 &rng) {
+		    std::string name = "absent" + std::to_string(rng() % 1000);
+		    bool found = indexed
+			? index.find(name) != nullptr
+			: scan(disk, dir, name.c_str(), nullptr) != 0;
+		    assert(!found);
+		}));
+	    add(method);
+
+	    // A create: check the name is free, take a slot and write the
+	    // direntry block.  The entry is removed again (untimed), so
+	    // the directory stays as full as it was.
+	    results.push_back(timed("dir.create", 1, seconds,
+		[&](unsigned int, std::mt19937 &) {
+		    const char *name = "newfile.txt";
+		    dir_index::location where;
+
+		    if (indexed) {
+			assert(!index.find(name));
+			bool ok = index.free_slot(where);
+			assert(ok);
+			index.insert(name, where, 2000);
+		    } else {
+			uint32_t inode = scan(disk, dir, name, &where);
+			assert(!inode);
+		    }
+		    set_entry(disk, dir, where, name, 2000);
+
+		    if (indexed) {
+			index.erase(name);
+		    }
+		    set_entry(disk, dir, where, "", 0);
+		}));
+	    add(method);
+	}
+    }
+}
+
+void hoh_cases(std::vector<result> &results, unsigned int max_threads,
+	       double seconds)
+{
+    using bench_mutex = instrumented_mutex<no_instrumentation>;
+    const unsigned int length = 1000;
+
+    std::vector<std::string>  words(length, "word");
+    hoh_list<bench_mutex>     list(words.begin(), words.end());
+
+    for (bool optimistic : {false, true}) {
+	for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	    results.push_back(timed("hoh.lookup", n, seconds,
+		[&](unsigned int, std::mt19937 &rng) {
+		    std::unique_lock<bench_mutex> lock;
+		    unsigned int i = 1 + rng() % length;
+		    if (optimistic) {
+			list.lookup_optimistic(i, lock);
+		    } else {
+			list.lookup(i, lock);
+		    }
+		}));
+	    results.back().params.emplace_back("length",
+					       std::to_string(length));
+	    results.back().params.emplace_back(
+		"method", optimistic ? "optimistic" : "hand_over_hand");
+	}
+    }
+}
+
+// What the map holds; counts how many were ever made
+struct map_object {
+    static std::atomic<uint64_t> made;
+    map_object() { made++; }
+};
+std::atomic<uint64_t> map_object::made(0);
+
+void map_cases(std::vector<result> &results, unsigned int max_threads,
+	       double seconds)
+{
+    const unsigned int count = 10000;
+
+    std::vector<std::string> names;
+    for (unsigned int i = 0; i < count; i++) {
+	names.push_back("file" + std::to_string(i) + ".txt");
+    }
+
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	dynamic_map<map_object> map;
+
+	// Every other name stays alive, so about half the lookups hit
+	std::vector<std::shared_ptr<map_object>> alive;
+	for (unsigned int i = 0; i < count; i += 2) {
+	    alive.push_back(map.lookup(names[i]));
+	}
+
+	uint64_t made = map_object::made;
+	results.push_back(timed("map.lookup", n, seconds,
+	    [&](unsigned int, std::mt19937 &rng) {
+		map.lookup(names[rng() % count]);
+	    }));
+
+	result &r = results.back();
+	double misses = map_object::made - made;
+	r.params.emplace_back("names", std::to_string(count));
+	r.extra.emplace_back("hit_rate",
+			     r.ns.empty() ? 0 : 1 - misses / r.ns.size());
+    }
+}
+
+// A tree of directories held in memory, for the cases that only need a
+// resolver: dirs directories under the root, each holding files files
+// named "f0", "f1", ...  Directory i is inode block 1 + i, and its file
+// j is block 1 + dirs + i * files + j.
+class memory_tree {
+    std::map<std::pair<uint32_t, std::string>, uint32_t> entries;
+
+public:
+    const unsigned int dirs, files;
+
+    memory_tree(unsigned int dirs_, unsigned int files_)
+	: dirs(dirs_), files(files_)
+    {
+	for (unsigned int i = 0; i < dirs; i++) {
+	    entries[{0, "d" + std::to_string(i)}] = 1 + i;
+	    for (unsigned int j = 0; j < files; j++) {
+		entries[{1 + i, "f" + std::to_string(j)}] = file(i, j);
+	    }
+	}
+    }
+
+    uint32_t file(unsigned int dir, unsigned int f) const
+    {
+	return 1 + dirs + dir * files + f;
+    }
+
+    std::string path(unsigned int dir, unsigned int f) const
+    {
+	return "/d" + std::to_string(dir) + "/f" + std::to_string(f);
+    }
+
+    // EFFECTS: returns the inode block of name in parent, or 0
+    uint32_t resolve(uint32_t parent, const std::string &name) const
+    {
+	auto it = entries.find({parent, name});
+	return it == entries.end() ? 0 : it->second;
+    }
+};
+
+void path_lock_cases(std::vector<result> &results, unsigned int max_threads,
+		     double seconds)
+{
+    memory_tree tree(4, 16);
+    lock_table  table;
+    lock_table::resolver resolve = [&](uint32_t parent,
+				       const std::string &name) {
+	return tree.resolve(parent, name);
+    };
+
+    // EFFECTS: starts a thread taking the lock of path in mode, and
+    //          returns whether it got the lock within a second, i.e. did
+    //          not wait for one held here.  *waiter finishes once it has
+    //          had and dropped the lock.
+    auto can_lock = [&](const std::string &path, block_lock::mode_t mode,
+			std::future<void> *waiter) {
+	*waiter = std::async(std::launch::async, [&table, &resolve, path,
+						  mode] {
+	    block_lock lock;
+	    table.lock_path(path, lock, mode, resolve);
+	});
+	return waiter->wait_for(std::chrono::seconds(1)) ==
+	       std::future_status::ready;
+    };
+
+    // The directories on the way are only locked shared, and a file's
+    // lock does not spill over to its neighbours
+    {
+	std::future<void> waiter;
+	block_lock        dir(table, 1, block_lock::shared);
+	block_lock        file;
+	uint32_t          b = table.lock_path(tree.path(0, 0), file,
+					      block_lock::exclusive,
+					      resolve);
+	assert(b == tree.file(0, 0) && file.mode() == block_lock::exclusive);
+	assert(table.size() == 2);
+	assert(can_lock(tree.path(0, 1), block_lock::exclusive, &waiter));
+	assert(can_lock("/d0", block_lock::shared, &waiter));
+	assert(!can_lock(tree.path(0, 0), block_lock::shared, &waiter));
+
+	file.unlock();
+	waiter.get();
+    }
+    assert(table.size() == 0);
+
+    // Every caller holds its file exclusively
+    std::vector<std::atomic<unsigned int>> holders(tree.dirs * tree.files);
+
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	results.push_back(timed("path.lock", n, seconds,
+	    [&](unsigned int, std::mt19937 &rng) {
+		unsigned int i = rng() % tree.dirs, j = rng() % tree.files;
+		block_lock   lock;
+		uint32_t     b = table.lock_path(tree.path(i, j), lock,
+						 block_lock::exclusive,
+						 resolve);
+		assert(b == tree.file(i, j));
+
+		unsigned int held = holders[i * tree.files + j]++;
+		assert(held == 0);
+		holders[i * tree.files + j]--;
+	    }));
+	results.back().params.emplace_back("depth", "2");
+	results.back().params.emplace_back(
+	    "files", std::to_string(tree.dirs * tree.files));
+
+	// The locks went away with the last block_lock on them
+	assert(table.size() == 0);
+    }
+}
+
+void path_resolve_cases(std::vector<result> &results,
+			unsigned int max_threads, double seconds)
+{
+    memory_tree           tree(4, 16);
+    std::atomic<uint64_t> calls(0);
+    dentry_cache::resolver resolve = [&](uint32_t parent,
+					 const std::string &name) {
+	calls++;
+	return tree.resolve(parent, name);
+    };
+
+    // Misses go to the disk once, and creates and deletes are seen
+    // without going there again
+    {
+	dentry_cache cache;
+	uint32_t     absent = tree.file(tree.dirs, 0);
+
+	assert(cache.resolve_path(tree.path(0, 0), resolve) ==
+	       tree.file(0, 0) && calls == 2);
+	assert(cache.resolve_path(tree.path(0, 0), resolve) ==
+	       tree.file(0, 0) && calls == 2);
+	assert(cache.resolve_path("/d0/new", resolve) ==
+	       dentry_cache::negative && calls == 3);
+	assert(cache.resolve_path("/d0/new", resolve) ==
+	       dentry_cache::negative && calls == 3);
+	assert(cache.stats().negative_hits == 1);
+
+	cache.created(1, "new", absent);
+	assert(cache.resolve_path("/d0/new", resolve) == absent);
+	cache.deleted(1, "new");
+	assert(cache.resolve_path("/d0/new", resolve) ==
+	       dentry_cache::negative);
+	assert(cache.resolve_path("/none/f0", resolve) ==
+	       dentry_cache::negative && calls == 4);
+	assert(cache.resolve_path("/", resolve) == 0 && calls == 4);
+    }
+
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	dentry_cache cache;
+
+	results.push_back(timed("path.resolve", n, seconds,
+	    [&](unsigned int, std::mt19937 &rng) {
+		unsigned int i = rng() % tree.dirs, j = rng() % tree.files;
+		bool         present = rng() % 4 != 0;
+		std::string  path = present ? tree.path(i, j) :
+				    tree.path(i, j) + ".old";
+		uint32_t     b = cache.resolve_path(path, resolve);
+		assert(b == (present ? tree.file(i, j)
+				     : dentry_cache::negative));
+	    }));
+
+	result               &r = results.back();
+	dentry_cache::stats_t s = cache.stats();
+	r.params.emplace_back("depth", "2");
+	r.extra.emplace_back("hit_rate", s.hits + s.misses == 0 ? 0 :
+			     double(s.hits) / (s.hits + s.misses));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    double       seconds = argc > 2 ? atof(argv[2]) : 0.2;
+
+    // A zero-filled scratch image of the same size as the disk
+    std::string path = "/tmp/fs_bench." + std::to_string(getpid()) + ".disk";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    int status = ftruncate(fd, off_t(FS_DISKSIZE) * FS_BLOCKSIZE);
+    assert(status == 0);
+    close(fd);
+
+    std::vector<result> results;
+    disk_cases(results, path, max_threads, seconds);
+    dir_cases(results, path, seconds);
+    hoh_cases(results, max_threads, seconds);
+    map_cases(results, max_threads, seconds);
+    path_lock_cases(results, max_threads, seconds);
+    path_resolve_cases(results, max_threads, seconds);
+    unlink(path.c_str());
+
+    printf("{\n  \"suite\": \"fsbench\",\n  \"version\": 1,\n"
+	   "  \"max_threads\": %u,\n  \"seconds_per_case\": %g,\n"
+	   "  \"hardware_threads\": %u,\n  \"results\": [\n", max_threads,
+	   seconds, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < results.size(); i++) {
+	print(results[i], i + 1 == results.size());
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ * hoh_list.h
+ *
+ * The hand-over-hand locked list from hoh.cpp: a singly-linked list of
+ * strings with a sentinel node, where lookup returns the nth node with
+ * its lock held exclusively.  It is a template over the lock type, so
+ * the same list can run with verbose_mutex in the demo and with a bare
+ * std::shared_mutex in benchmarks.
+ *
+ * Nodes are only ever appended, never unlinked, and live as long as the
+ * list.  lookup_optimistic relies on that: it walks with plain atomic
+ * loads instead of locks, and needs the append counter (version) only
+ * to tell a list that really is too short from one that grew while it
+ * was walking.
+ *
+ * Appends go straight to a tail pointer, and may be made by any number
+ * of threads at once.  Optionally every stride-th node is also recorded
+ * in an index, so that both lookups can start from the last indexed
+ * node before the one wanted instead of from the sentinel: a lookup
+ * then walks at most stride nodes.  Since nodes never move, the nodes
+ * before the starting point cannot affect the result and need not be
+ * locked.
+ *
+ * Nodes come from a pool owned by the list: they are carved out of
+ * large chunks, so that successive nodes sit next to each other in
+ * memory, and are all freed at once when the list is destroyed.  Each
+ * node is cache-line aligned, with its next pointer and lock in the
+ * first line.  Short elements are stored inside the node by
+ * std::string's small-string optimization.
+ */
+
+#ifndef _HOH_LIST_H_
+#define _HOH_LIST_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <new>
+#include <string>
+#include <vector>
+
+template <typename Mutex>
+class hoh_list {
+public:
+    // A slingly-linked list of strings, with a sentinel node
+    struct alignas(64) node {
+	std::atomic<node *>   next;
+	Mutex                 mutex;
+	std::string           element;
+
+	node(std::string _elt);
+    };
+
+    // EFFECTS: creates an empty list, indexing every stride-th node
+    //          (no index if stride is 0)
+    explicit hoh_list(unsigned int stride = 0);
+
+    // EFFECTS: builds a list of the strings in [first, last)
+    template <typename It>
+    hoh_list(It first, It last, unsigned int stride = 0);
+
+    ~hoh_list();
+
+    // EFFECTS: appends s to the list in O(1). Is thread-safe
+    void add(std::string s);
+
+    node *lookup(unsigned int n, std::unique_lock<Mutex> &lock);
+    node *lookup_optimistic(unsigned int n, std::unique_lock<Mutex> &lock);
+
+private:
+    // The index is a directory of fixed-size segments, allocated as the
+    // list grows, so published entries never move.  Entry i is the node
+    // at position i * stride + 1.
+    static const unsigned int segment_size = 1024;
+    static const unsigned int max_segments = 4096;
+
+    using segment = std::atomic<node *>[segment_size];
+
+    // Allocates nodes from chunks of chunk_nodes nodes.  Not thread safe.
+    class node_pool {
+	static const unsigned int chunk_nodes = 256;
+
+	std::vector<node *>  chunks;
+	unsigned int         used = chunk_nodes;   // in the last chunk
+
+    public:
+	~node_pool();
+	node *make(std::string s);
+    };
+
+    // Protected by append_lock (the sentinel is made by the constructor)
+    node_pool               pool;
+
+    // Reminder: this points to a sentinel value, not a real node
+    node                   *list;
+
+    // Number of nodes appended so far
+    std::atomic<uint64_t>   version;
+
+    // Appends are serialized on append_lock; tail is the last node
+    std::mutex              append_lock;
+    node                   *tail;
+
+    const unsigned int                       stride;
+    std::unique_ptr<std::atomic<segment *>[]> index;
+
+    void find_start(unsigned int n, node *&start, unsigned int &pos);
+};
+
+template <typename Mutex>
+hoh_list<Mutex>::node::node(std::string _elt)
+    : next(nullptr), element(_elt)
+{
+}
+
+template <typename Mutex>
+hoh_list<Mutex>::node_pool::~node_pool()
+{
+    // Every chunk but the last is full
+    for (size_t c = 0; c < chunks.size(); c++) {
+	unsigned int n = c + 1 < chunks.size() ? chunk_nodes : used;
+	for (unsigned int i = 0; i < n; i++) {
+	    chunks[c][i].~node();
+	}
+	::operator delete(chunks[c], std::align_val_t(alignof(node)));
+    }
+}
+
+template <typename Mutex>
+typename hoh_list<Mutex>::node *hoh_list<Mutex>::node_pool::make(std::string s)
+{
+    if (used == chunk_nodes) {
+	void *chunk = ::operator new(chunk_nodes * sizeof(node),
+				     std::align_val_t(alignof(node)));
+	chunks.push_back(static_cast<node *>(chunk));
+	used = 0;
+    }
+    return new (&chunks.back()[used++]) node(s);
+}
+
+template <typename Mutex>
+hoh_list<Mutex>::hoh_list(unsigned int stride_)
+    : list(pool.make("")), version(0), tail(list), stride(stride_)
+{
+    if (stride) {
+	index.reset(new std::atomic<segment *>[max_segments]);
+	for (unsigned int i = 0; i < max_segments; i++) {
+	    index[i].store(nullptr, std::memory_order_relaxed);
+	}
+    }
+}
+
+template <typename Mutex>
+template <typename It>
+hoh_list<Mutex>::hoh_list(It first, It last, unsigned int stride_)
+    : hoh_list(stride_)
+{
+    for (; first != last; ++first) {
+	add(*first);
+    }
+}
+
+template <typename Mutex>
+hoh_list<Mutex>::~hoh_list()
+{
+    // The nodes themselves are freed in bulk by the pool
+    for (unsigned int i = 0; stride && i < max_segments; i++) {
+	delete[] index[i].load();
+    }
+}
+
+template <typename Mutex>
+void hoh_list<Mutex>::add(std::string s)
+{
+    std::lock_guard<std::mutex> lock(append_lock);
+
+    node *new_node = pool.make(s);
+    uint64_t position = version.load(std::memory_order_relaxed) + 1;
+
+    // Index the node before it is counted, so that a reader who sees the
+    // new count also finds the index entry
+    if (stride && (position - 1) % stride == 0) {
+	uint64_t entry = (position - 1) / stride;
+
+	if (entry < uint64_t(max_segments) * segment_size) {
+	    std::atomic<segment *> &seg = index[entry / segment_size];
+	    if (!seg.load(std::memory_order_relaxed)) {
+		seg.store(new segment[1], std::memory_order_release);
+	    }
+	    (*seg.load(std::memory_order_relaxed))[entry % segment_size]
+		.store(new_node, std::memory_order_relaxed);
+	}
+    }
+
+    // The release stores publish the node to optimistic readers
+    tail->next.store(new_node, std::memory_order_release);
+    tail = new_node;
+    version.store(position, std::memory_order_release);
+}
+
+template <typename Mutex>
+void hoh_list<Mutex>::find_start(unsigned int n, node *&start,
+				 unsigned int &pos)
+// REQUIRES: n > 0
+//
+// EFFECTS: sets start to the closest node before the nth that can be
+//          reached without walking, and pos to its position (0 for the
+//          sentinel)
+{
+    start = list;
+    pos = 0;
+    if (!stride || n < 2) {
+	return;
+    }
+
+    // The last indexed node before n, limited to the ones published
+    uint64_t size = version.load(std::memory_order_acquire);
+    uint64_t entries = std::min((size + stride - 1) / stride,
+				uint64_t(max_segments) * segment_size);
+    uint64_t entry = std::min(uint64_t(n - 2) / stride, entries - 1);
+
+    if (entries) {
+	segment *seg = index[entry / segment_size].load(
+	    std::memory_order_acquire);
+	start = (*seg)[entry % segment_size].load(std::memory_order_relaxed);
+	pos = entry * stride + 1;
+    }
+}
+
+template <typename Mutex>
+typename hoh_list<Mutex>::node *
+hoh_list<Mutex>::lookup(unsigned int n, std::unique_lock<Mutex> &lock)
+// REQUIRES: list is not empty
+//           0 < n <= length of the list
+//           lock does not hold its associated mutex, if any
+//
+// MODIFIES: lock
+//
+// EFFECTS: returns a pointer to the nth node of the list, with lock
+//          holding the result node's mutex exclusively. Is
+//          thread-safe
+{
+
+    if (!n || lock.owns_lock()) {
+	throw std::runtime_error("lookup: invalid argument");
+    }
+
+    // Start from the sentinel or, with an index, from the last indexed
+    // node before n; start is at position pos in the list.
+    node          *start;
+    unsigned int   pos;
+    find_start(n, start, pos);
+
+    // Acquire a read lock on the start node, and initialize our
+    // traversal/return value. Note that the initialization of result
+    // _must_ come after the instantiation of the read_lock or else it
+    // is an unsafe read of a shared variable!
+
+    std::shared_lock<Mutex>          read_lock(start->mutex);
+    node                            *result = start->next.load();
+
+
+    // Check requirements of the function.
+    if (!result) {
+	throw std::runtime_error(pos ? "lookup: list too short"
+				     : "lookup: list is empty");
+    }
+    n -= pos;
+
+    // Now we have to traverse the list from the sentinel to the node
+    // _prior_to_ the node we want to return. If we are returning the
+    // first node in the list (i.e. n==1) we are already
+    // there. Otherwise we need to walk forward. We do this
+    // hand-over-hand with shared locks
+    //
+    // The loop invariants on entry are:
+    //
+    //         n-1: number of steps forward we need to
+    //              take. Decremented each iteration.
+    //
+    //         read_lock: holds a shared lock of the node with a next
+    //                    value equal to result. Moved forward one
+    //                    node each iteration
+    //
+    //         result: points to the node _after_ the one currently
+    //                 locked; this node must exist. Advanced each
+    //                 iteration.
+
+    while (--n) {
+
+	// Acquire a read lock on next node in the list
+	std::shared_lock<Mutex> next_lock(result->mutex);
+
+	// before the next line of code, read_lock holds the lock of
+	// some node X, while next_lock holds the lock of the node
+	// X+1.
+
+	read_lock.swap(next_lock);
+
+	// After that line of code, the situation is
+	// reversed. read_lock holds the lock on node X+1, while
+	// next_lock holds the lock on X
+
+
+	// Advance the result pointer and check that we haven't run
+	// off the end of the list
+	result = result->next.load();
+	if (!result) {
+	    throw std::runtime_error("lookup: list too short");
+	}
+
+	// At the end of this iteration of the loop, next_lock goes
+	// out of scope. As a consequence, we drop the lock it holds
+	// on node X's mutex.
+    }
+
+
+    // At this point, result points to the node we want to return, but
+    // it is not yet locked. We hold the lock on its predecessor node
+    // in read_lock. So, we will acquire the lock on the target node:
+
+    std::unique_lock<Mutex>            result_lock(result->mutex);
+
+    // Swap it with the caller's argument (which must be modified to
+    // hold that lock)
+    lock.swap(result_lock);
+
+    // When we return the pointer to the target node, both result_lock
+    // and read_lock will go out of scope. result_lock doesn't hold
+    // anything by (verified) REQUIRES assumption. read_lock holds the
+    // shared mutex on the predecessar node, which we no longer need.
+
+    return result;
+}
+
+template <typename Mutex>
+typename hoh_list<Mutex>::node *
+hoh_list<Mutex>::lookup_optimistic(unsigned int n,
+				   std::unique_lock<Mutex> &lock)
+// REQUIRES: list is not empty
+//           0 < n <= length of the list
+//           lock does not hold its associated mutex, if any
+//
+// MODIFIES: lock
+//
+// EFFECTS: same as lookup, but without taking any lock on the way to
+//          the nth node, so readers write no shared memory until they
+//          lock the node they want
+{
+    // How many times to retry after losing a race with add() before
+    // falling back to hand-over-hand
+    const unsigned int max_attempts = 4;
+
+    if (!n || lock.owns_lock()) {
+	throw std::runtime_error("lookup: invalid argument");
+    }
+
+    for (unsigned int attempt = 0; attempt < max_attempts; attempt++) {
+	uint64_t      before = version.load(std::memory_order_acquire);
+	node         *start;
+	unsigned int  pos;
+	find_start(n, start, pos);
+
+	node         *result = start->next.load(std::memory_order_acquire);
+	unsigned int  steps = n - pos;
+
+	// The acquire loads pair with the release store in add(), so
+	// every node we reach is fully constructed.
+	while (result && --steps) {
+	    result = result->next.load(std::memory_order_acquire);
+	}
+
+	if (result) {
+	    // Nodes never move or go away, so the node reached is the
+	    // nth one for good; all that is left is to lock it.
+	    std::unique_lock<Mutex> result_lock(result->mutex);
+	    lock.swap(result_lock);
+	    return result;
+	}
+
+	// We ran off the end. That is only the right answer if nothing
+	// was appended while we were walking.
+	if (version.load(std::memory_order_acquire) == before) {
+	    throw std::runtime_error(before ? "lookup: list too short"
+					    : "lookup: list is empty");
+	}
+    }
+
+    return lookup(n, lock);
+}
+
+#endif /* _HOH_LIST_H_ */
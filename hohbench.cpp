@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hoh_list.h"
+#include "instrumented_mutex.h"
+
+// Compare hand-over-hand lookup with lookup_optimistic on lists of 10,
+// 100, ... nodes, with 1, 2, 4, ... threads doing random lookups.  With
+// an index stride, the lists index every stride-th node.
+//
+//     usage: hohbench [max threads] [max length] [seconds per run]
+//                     [index stride]
+
+using bench_mutex = instrumented_mutex<no_instrumentation>;
+using bench_list = hoh_list<bench_mutex>;
+
+struct result {
+    double lookups_per_sec;
+    double ns_per_node;                // time per list position looked up
+};
+
+result run(bench_list &list, unsigned int length, unsigned int nthreads,
+	   bool optimistic, double seconds)
+{
+    std::atomic<bool>      stop(false);
+    std::atomic<uint64_t>  lookups(0), nodes(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([&, t] {
+	    std::mt19937 rng(t + 1);
+	    std::uniform_int_distribution<unsigned int> pick(1, length);
+	    uint64_t my_lookups = 0, my_nodes = 0;
+
+	    while (!stop.load(std::memory_order_relaxed)) {
+		std::unique_lock<bench_mutex> lock;
+		unsigned int n = pick(rng);
+
+		if (optimistic) {
+		    list.lookup_optimistic(n, lock);
+		} else {
+		    list.lookup(n, lock);
+		}
+		my_lookups++;
+		my_nodes += n;
+	    }
+	    lookups += my_lookups;
+	    nodes += my_nodes;
+	});
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &thread : threads) {
+	thread.join();
+    }
+
+    return {lookups / seconds, seconds * nthreads * 1e9 / nodes};
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    unsigned int max_length = argc > 2 ? atoi(argv[2]) : 1000000;
+    double       seconds = argc > 3 ? atof(argv[3]) : 0.05;
+    unsigned int stride = argc > 4 ? atoi(argv[4]) : 0;
+
+    std::cout << " length  threads   hoh lookups/s  ns/node"
+	      << "   optimistic lookups/s  ns/node  speedup\n";
+
+    for (unsigned int length = 10; length <= max_length; length *= 10) {
+	std::vector<std::string> words(length, "word");
+	bench_list list(words.begin(), words.end(), stride);
+
+	for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	    result locked = run(list, length, n, false, seconds);
+	    result optimistic = run(list, length, n, true, seconds);
+
+	    std::cout << std::setw(7) << length << std::setw(9) << n
+		      << std::fixed << std::setprecision(0)
+		      << std::setw(16) << locked.lookups_per_sec
+		      << std::setprecision(1) << std::setw(9)
+		      << locked.ns_per_node << std::setprecision(0)
+		      << std::setw(23) << optimistic.lookups_per_sec
+		      << std::setprecision(1) << std::setw(9)
+		      << optimistic.ns_per_node << std::setprecision(2)
+		      << std::setw(8)
+		      << optimistic.lookups_per_sec / locked.lookups_per_sec
+		      << "x\n";
+	}
+    }
+
+    return 0;
+}
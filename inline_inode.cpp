@@ -0,0 +1,139 @@
+#include "inline_inode.h"
+#include "extent_inode.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// Returns the number of bytes of block buf up to its last non-zero byte
+unsigned int used_bytes(const void *buf)
+{
+    const char *p = static_cast<const char *>(buf);
+    unsigned int n = FS_BLOCKSIZE;
+
+    while (n > 0 && !p[n - 1]) {
+	n--;
+    }
+    return n;
+}
+
+// Copies the data of inline inode into the block buf
+void copy_inline(const fs_inode &inode, void *buf)
+{
+    fs_inline_inode x;
+    memcpy(&x, &inode, sizeof(x));
+
+    assert(x.length <= FS_INLINE_BYTES);
+    memcpy(buf, x.data, x.length);
+    memset(static_cast<char *>(buf) + x.length, 0, FS_BLOCKSIZE - x.length);
+}
+
+} // namespace
+
+bool fits_inline(const void *buf)
+{
+    return used_bytes(buf) <= FS_INLINE_BYTES;
+}
+
+void make_inline(fs_inode &inode, const void *buf)
+{
+    assert(inode.type == 'f' || is_inline_inode(inode));
+    assert(inode.size <= 1);
+
+    fs_inline_inode x;
+    memset(&x, 0, sizeof(x));
+    x.type = FS_INLINE_FILE;
+    memcpy(x.owner, inode.owner, sizeof(x.owner));
+    x.size = 1;
+    x.length = used_bytes(buf);
+    assert(x.length <= FS_INLINE_BYTES);
+    memcpy(x.data, buf, x.length);
+
+    memcpy(&inode, &x, sizeof(x));
+}
+
+void make_plain(fs_inode &inode, unsigned int block, void *buf)
+{
+    assert(is_inline_inode(inode));
+
+    copy_inline(inode, buf);
+
+    fs_inode plain;
+    memset(&plain, 0, sizeof(plain));
+    plain.type = 'f';
+    memcpy(plain.owner, inode.owner, sizeof(plain.owner));
+    plain.size = 1;
+    plain.blocks[0] = block;
+
+    inode = plain;
+}
+
+void read_file_block(block_device &disk, const fs_inode &inode,
+		     unsigned int index, void *buf)
+{
+    assert(index < inode.size);
+
+    if (is_inline_inode(inode)) {
+	copy_inline(inode, buf);
+    } else if (is_extent_inode(inode)) {
+	inode_map map;
+	map.load(disk, inode);
+	disk.readblock(map.blocks()[index], buf);
+    } else {
+	disk.readblock(inode.blocks[index], buf);
+    }
+}
+
+bool write_file_block(block_device &disk, unsigned int inode_block,
+		      fs_inode &inode, unsigned int index, const void *buf,
+		      const std::function<unsigned int()> &allocate,
+		      const std::function<void(unsigned int)> &release)
+{
+    assert(inode.type == 'f' || is_inline_inode(inode));
+    assert(index < inode.size ||
+	   (index == inode.size && inode.size < FS_MAXFILEBLOCKS));
+
+    // Still one block that fits: only the inode is written
+    if (index == 0 && inode.size <= 1 && fits_inline(buf) &&
+	(inode.size == 0 || is_inline_inode(inode))) {
+	make_inline(inode, buf);
+	disk.writeblock(inode_block, &inode);
+	return true;
+    }
+
+    // Overwriting a data block leaves the inode as it is
+    if (!is_inline_inode(inode) && index < inode.size) {
+	disk.writeblock(inode.blocks[index], buf);
+	return true;
+    }
+
+    // Otherwise the inode changes: promote it and/or append a block,
+    // taking every block needed before writing anything
+    bool promote = is_inline_inode(inode);
+    bool append = index == inode.size;
+
+    unsigned int first = promote ? allocate() : 0;
+    unsigned int added = append && (!promote || first) ? allocate() : 0;
+    if ((promote && !first) || (append && !added)) {
+	if (first) {
+	    release(first);
+	}
+	return false;
+    }
+
+    fs_inode updated = inode;
+    if (promote) {
+	char data[FS_BLOCKSIZE];
+	make_plain(updated, first, data);
+	disk.writeblock(first, index == 0 ? buf : data);
+    }
+    if (append) {
+	disk.writeblock(added, buf);
+	updated.blocks[updated.size++] = added;
+    }
+
+    disk.writeblock(inode_block, &updated);
+    inode = updated;
+    return true;
+}
@@ -0,0 +1,93 @@
+/*
+ * inline_inode.h
+ *
+ * Small files stored in their inode block.  A file of one block whose
+ * contents past the first FS_INLINE_BYTES bytes are all zero (anything
+ * up to 492 bytes of text, say) does not need a data block: its inode
+ * has type FS_INLINE_FILE and carries the data itself, so reading it
+ * takes one disk read instead of two and creating it one write.
+ *
+ * An inline inode starts like an fs_inode (type, owner, size in blocks,
+ * which is always 1), followed by the number of bytes kept and the
+ * bytes themselves; the rest of the block reads as zeros.  It has no
+ * data blocks of its own.
+ *
+ * read_file_block and write_file_block hide the difference: a file
+ * whose first block fits is created inline, and is promoted to a plain
+ * fs_inode with real data blocks as soon as it no longer fits or grows
+ * a second block.
+ */
+
+#ifndef _INLINE_INODE_H_
+#define _INLINE_INODE_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "block_device.h"
+
+static const char FS_INLINE_FILE = 'i';
+
+/*
+ * Bytes of data in an inline inode (after type, owner, size and length)
+ */
+static const unsigned int FS_INLINE_BYTES =
+    FS_BLOCKSIZE - (FS_MAXUSERNAME + 2) - 2 * sizeof(uint32_t);
+
+struct fs_inline_inode {
+    char type;                             // FS_INLINE_FILE
+    char owner[FS_MAXUSERNAME + 1];        // owner of this file
+    uint32_t size;                         // size of this file in blocks
+					   // (1)
+    uint32_t length;                       // bytes of data kept
+    char data[FS_INLINE_BYTES];            // the first length bytes of
+					   // block 0 of the file
+};
+
+static_assert(sizeof(fs_inline_inode) == FS_BLOCKSIZE,
+	      "an inline inode must be a block");
+
+inline bool is_inline_inode(const fs_inode &inode)
+{
+    return inode.type == FS_INLINE_FILE;
+}
+
+// EFFECTS: returns true if the data block buf can be kept inline
+bool fits_inline(const void *buf);
+
+// REQUIRES: inode is a file of at most one block, fits_inline(buf)
+// MODIFIES: inode
+// EFFECTS: turns inode into an inline inode holding buf as block 0
+void make_inline(fs_inode &inode, const void *buf);
+
+// REQUIRES: is_inline_inode(inode)
+// MODIFIES: inode, buf
+// EFFECTS: turns inode into a plain fs_inode with block 0 at block, and
+//          copies the data it held into buf.  buf must be written to
+//          block before inode is written.
+void make_plain(fs_inode &inode, unsigned int block, void *buf);
+
+// REQUIRES: index < inode.size
+// EFFECTS: reads block index of the file whose inode is inode (in any
+//          format) into buf.  A block of an inline inode is copied out
+//          without reading the disk.
+void read_file_block(block_device &disk, const fs_inode &inode,
+		     unsigned int index, void *buf);
+
+// REQUIRES: inode is the plain or inline file inode at inode_block,
+//           index < inode.size, or index == inode.size <
+//           FS_MAXFILEBLOCKS to append
+// MODIFIES: inode
+// EFFECTS: writes buf as block index of the file, appending a block if
+//          index == inode.size.  The file is kept inline while it fits,
+//          and otherwise gets data blocks from allocate (which returns
+//          0 when the disk is full).  Data blocks are written before the
+//          inode that points to them.  Returns false if allocate ran
+//          out, in which case the file is unchanged and the blocks
+//          taken are handed back to release.
+bool write_file_block(block_device &disk, unsigned int inode_block,
+		      fs_inode &inode, unsigned int index, const void *buf,
+		      const std::function<unsigned int()> &allocate,
+		      const std::function<void(unsigned int)> &release);
+
+#endif /* _INLINE_INODE_H_ */
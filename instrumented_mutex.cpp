@@ -0,0 +1,214 @@
+#include "instrumented_mutex.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Every thread gets its own Buffer the first time it records anything.
+// The buffers are also kept in a list so dump() can find them; they are
+// never freed, so nothing is lost when a thread exits.
+template <typename Buffer>
+class registry {
+    std::mutex                            m;
+    std::vector<std::shared_ptr<Buffer>>  buffers;
+
+public:
+    static registry &get()
+    {
+	static registry r;
+	return r;
+    }
+
+    Buffer &local()
+    {
+	thread_local std::shared_ptr<Buffer> mine;
+	if (!mine) {
+	    mine = std::make_shared<Buffer>();
+	    std::lock_guard<std::mutex> lock(m);
+	    mine->thread = buffers.size();
+	    buffers.push_back(mine);
+	}
+	return *mine;
+    }
+
+    std::vector<std::shared_ptr<Buffer>> all()
+    {
+	std::lock_guard<std::mutex> lock(m);
+	return buffers;
+    }
+};
+
+// Counting: totals per lock.  The buffer lock is only ever contended by
+// a concurrent dump.
+struct lock_counts {
+    uint64_t acquires = 0;
+    uint64_t shared = 0;
+    uint64_t contended = 0;
+    uint64_t waits[65] = {};           // waits[b]: 2^(b-1) <= ns < 2^b
+};
+
+struct count_buffer {
+    std::mutex                                  m;
+    unsigned int                                thread;
+    std::unordered_map<unsigned int, lock_counts> locks;
+};
+
+// Tracing: a bounded log of events per thread
+struct event {
+    enum kind_t { create, acquire, release };
+
+    uint64_t      time;
+    unsigned int  id;
+    kind_t        kind;
+    bool          shared;
+    uint64_t      wait_ns;
+    unsigned int  thread;
+};
+
+const size_t max_events = 1 << 16;    // per thread, between dumps
+
+struct trace_buffer {
+    std::mutex          m;
+    unsigned int        thread;
+    std::vector<event>  events;
+    uint64_t            dropped = 0;
+};
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace(unsigned int id, event::kind_t kind, bool shared, uint64_t wait)
+{
+    trace_buffer &b = registry<trace_buffer>::get().local();
+    std::lock_guard<std::mutex> lock(b.m);
+
+    if (b.events.size() < max_events) {
+	b.events.push_back({now(), id, kind, shared, wait, b.thread});
+    } else {
+	b.dropped++;
+    }
+}
+
+} // namespace
+
+void counting_instrumentation::acquired(unsigned int id, bool shared,
+					uint64_t wait_ns)
+{
+    count_buffer &b = registry<count_buffer>::get().local();
+    std::lock_guard<std::mutex> lock(b.m);
+
+    lock_counts &c = b.locks[id];
+    c.acquires++;
+    c.shared += shared;
+    if (wait_ns) {
+	c.contended++;
+	c.waits[64 - __builtin_clzll(wait_ns)]++;
+    }
+}
+
+void counting_instrumentation::dump(std::ostream &os)
+{
+    // Combine the threads' counts for each lock
+    std::map<unsigned int, lock_counts> totals;
+
+    for (auto &b : registry<count_buffer>::get().all()) {
+	std::lock_guard<std::mutex> lock(b->m);
+
+	for (auto &l : b->locks) {
+	    lock_counts &t = totals[l.first];
+	    t.acquires += l.second.acquires;
+	    t.shared += l.second.shared;
+	    t.contended += l.second.contended;
+	    for (unsigned int i = 0; i < 65; i++) {
+		t.waits[i] += l.second.waits[i];
+	    }
+	}
+    }
+
+    for (auto &t : totals) {
+	os << "lock # " << t.first << ": " << t.second.acquires
+	   << " acquires (" << t.second.shared << " shared), "
+	   << t.second.contended << " contended";
+	if (t.second.contended) {
+	    os << ", waits:";
+	    for (unsigned int i = 1; i < 65; i++) {
+		if (t.second.waits[i]) {
+		    os << " <2^" << i << "ns:" << t.second.waits[i];
+		}
+	    }
+	}
+	os << '\n';
+    }
+}
+
+void tracing_instrumentation::created(unsigned int id)
+{
+    trace(id, event::create, false, 0);
+}
+
+void tracing_instrumentation::acquired(unsigned int id, bool shared,
+				       uint64_t wait_ns)
+{
+    trace(id, event::acquire, shared, wait_ns);
+}
+
+void tracing_instrumentation::released(unsigned int id, bool shared)
+{
+    trace(id, event::release, shared, 0);
+}
+
+void tracing_instrumentation::dump(std::ostream &os)
+{
+    std::vector<event> events;
+    std::vector<unsigned int> threads;
+    uint64_t dropped = 0;
+
+    for (auto &b : registry<trace_buffer>::get().all()) {
+	std::lock_guard<std::mutex> lock(b->m);
+
+	if (!b->events.empty()) {
+	    threads.push_back(b->thread);
+	}
+	events.insert(events.end(), b->events.begin(), b->events.end());
+	b->events.clear();
+	dropped += b->dropped;
+	b->dropped = 0;
+    }
+
+    // Each thread's events are already in order; interleave them
+    std::stable_sort(events.begin(), events.end(),
+		     [](const event &a, const event &b) {
+			 return a.time < b.time;
+		     });
+
+    for (const event &e : events) {
+	os << "****** ";
+	if (threads.size() > 1) {
+	    os << "[thread " << e.thread << "] ";
+	}
+
+	if (e.kind == event::create) {
+	    os << "Creating lock # " << e.id;
+	} else {
+	    os << (e.shared ? "Shared " : "Exclusive ")
+	       << (e.kind == event::acquire ? "acquire" : "release")
+	       << " # " << e.id;
+	}
+	if (e.wait_ns) {
+	    os << " (waited " << e.wait_ns << "ns)";
+	}
+	os << '\n';
+    }
+
+    if (dropped) {
+	os << "****** " << dropped << " events dropped\n";
+    }
+}
@@ -0,0 +1,171 @@
+/*
+ * instrumented_mutex.h
+ *
+ * A shared_mutex wrapper whose instrumentation is chosen at compile time
+ * by a policy:
+ *
+ *   no_instrumentation        instrumented_mutex<no_instrumentation> is
+ *                             std::shared_mutex itself; nothing is added
+ *   counting_instrumentation  per lock: acquisitions, contended
+ *                             acquisitions and a histogram of wait times
+ *   tracing_instrumentation   every create/acquire/release, time stamped
+ *   stats_instrumentation     acquisitions, contended acquisitions and
+ *                             wait times for all locks together, in the
+ *                             fs_stats counters (see fs_stats.h)
+ *
+ * Events are recorded into buffers that belong to the thread doing the
+ * locking, so recording never takes a lock that another thread is
+ * likely to hold, and never prints.  Each policy's dump() writes what
+ * has been recorded so far.
+ */
+
+#ifndef _INSTRUMENTED_MUTEX_H_
+#define _INSTRUMENTED_MUTEX_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <shared_mutex>
+
+#include "fs_stats.h"
+#include "id_allocator.h"
+
+struct no_instrumentation {
+};
+
+struct counting_instrumentation {
+    static void created(unsigned int id) {}
+    static void acquired(unsigned int id, bool shared, uint64_t wait_ns);
+    static void released(unsigned int id, bool shared) {}
+
+    // EFFECTS: prints the totals of every lock recorded by any thread
+    static void dump(std::ostream &os);
+};
+
+struct tracing_instrumentation {
+    static void created(unsigned int id);
+    static void acquired(unsigned int id, bool shared, uint64_t wait_ns);
+    static void released(unsigned int id, bool shared);
+
+    // EFFECTS: prints the events recorded by all threads since the last
+    //          dump in time order, and discards them
+    static void dump(std::ostream &os);
+};
+
+struct stats_instrumentation {
+    static void created(unsigned int id) {}
+    static void released(unsigned int id, bool shared) {}
+
+    static void acquired(unsigned int id, bool shared, uint64_t wait_ns)
+    {
+	FS_COUNT(count_lock_acquires);
+	if (wait_ns) {
+	    FS_COUNT(count_lock_contended);
+	    FS_RECORD(time_lock_wait, wait_ns);
+	}
+    }
+
+    // EFFECTS: prints all the fs_stats totals
+    static void dump(std::ostream &os)
+    {
+	fs_stats::dump(os);
+    }
+};
+
+template <typename Policy>
+class basic_instrumented_mutex {
+    // Serial numbers 0, 1, ... (per policy), without a shared counter
+    using numbers = id_allocator<basic_instrumented_mutex>;
+
+    std::shared_mutex   m;
+    const unsigned int  serial_num;
+
+    static uint64_t now()
+    {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+public:
+    basic_instrumented_mutex()
+	: serial_num(numbers::allocate())
+    {
+	Policy::created(serial_num);
+    }
+
+    // An uncontended acquire is recorded with a wait of 0, a contended
+    // one with a wait of at least 1ns.  Only when try_lock fails is the
+    // clock read, around the blocking acquire.
+    void lock()
+    {
+	if (m.try_lock()) {
+	    Policy::acquired(serial_num, false, 0);
+	    return;
+	}
+	uint64_t start = now();
+	m.lock();
+	Policy::acquired(serial_num, false, now() - start + 1);
+    }
+
+    bool try_lock()
+    {
+	bool locked = m.try_lock();
+	if (locked) {
+	    Policy::acquired(serial_num, false, 0);
+	}
+	return locked;
+    }
+
+    void unlock()
+    {
+	Policy::released(serial_num, false);
+	m.unlock();
+    }
+
+    void lock_shared()
+    {
+	if (m.try_lock_shared()) {
+	    Policy::acquired(serial_num, true, 0);
+	    return;
+	}
+	uint64_t start = now();
+	m.lock_shared();
+	Policy::acquired(serial_num, true, now() - start + 1);
+    }
+
+    bool try_lock_shared()
+    {
+	bool locked = m.try_lock_shared();
+	if (locked) {
+	    Policy::acquired(serial_num, true, 0);
+	}
+	return locked;
+    }
+
+    void unlock_shared()
+    {
+	Policy::released(serial_num, true);
+	m.unlock_shared();
+    }
+
+    unsigned int id() const
+    {
+	return serial_num;
+    }
+};
+
+template <typename Policy>
+struct instrumented_mutex_type {
+    using type = basic_instrumented_mutex<Policy>;
+};
+
+template <>
+struct instrumented_mutex_type<no_instrumentation> {
+    using type = std::shared_mutex;
+};
+
+template <typename Policy>
+using instrumented_mutex = typename instrumented_mutex_type<Policy>::type;
+
+#endif /* _INSTRUMENTED_MUTEX_H_ */
@@ -0,0 +1,381 @@
+/*
+ * intrusive_map.h
+ *
+ * A dynamic_map whose objects carry their own reference count and are
+ * allocated from per-shard pools.
+ *
+ * dynamic_map hands out std::shared_ptrs: each live object costs a
+ * separate control block (for the deleter) with two atomic counts, and
+ * a weak_ptr in the table.  Here the count is a member of the object
+ * (T must derive from intrusive_map_object), the table holds a plain
+ * pointer, and objects are carved out of chunks that are recycled, so
+ * a miss costs no heap allocation once the pool has warmed up.
+ *
+ * The semantics are those of dynamic_map: while any handle to the
+ * object of a key exists, lookups of the key return it; once the last
+ * handle goes away the object is destroyed and its entry erased.
+ *
+ * Only the drop of the last reference locks the shard.  That 1 -> 0
+ * transition happens under the shard lock, the same lock lookups take
+ * to add a reference to an object they find, so a lookup never finds
+ * an object that is being destroyed.  Copying a handle is a single
+ * atomic increment.
+ *
+ * Unlike dynamic_map, the objects and handles must not outlive the map.
+ */
+
+#ifndef _INTRUSIVE_MAP_H_
+#define _INTRUSIVE_MAP_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dynamic_map.h"
+
+// Base class of the objects of an intrusive_map
+class intrusive_map_object {
+    template <typename, typename, typename, typename>
+    friend class intrusive_map;
+
+    std::atomic<unsigned int>  refs{0};
+    void                      *owner = nullptr;   // shard of the entry
+    std::size_t                hash = 0;
+};
+
+// REQUIRES: T derives from intrusive_map_object; Key is default
+//           constructible; Hash and Equal are stateless
+template <typename T, typename Key = std::string,
+	  typename Hash = dynamic_map_hash<Key>,
+	  typename Equal = std::equal_to<>>
+class intrusive_map {
+    struct slot {
+	T    *object = nullptr;              // nullptr if unused
+	Key   key{};
+    };
+
+    using storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    // Each shard on its own cache line, so shard locks do not contend
+    struct alignas(64) shard {
+	std::mutex                              m;
+	std::vector<slot>                       slots;  // power of two, or 0
+	std::size_t                             count = 0;
+
+	// Object pool: chunks are only freed with the map
+	std::vector<std::unique_ptr<storage[]>> chunks;
+	std::vector<void *>                     free_list;
+    };
+
+    static const std::size_t min_slots = 16;
+    static const std::size_t chunk_objects = 64;
+
+    std::unique_ptr<shard[]>  shards;
+    const unsigned int        nshards;
+
+    template <typename K>
+    static std::size_t probe(const shard &s, std::size_t h, const K &k);
+    static void erase(shard &s, const T *object);
+    static void rebuild(shard &s, std::size_t extra);
+    static void *allocate(shard &s);
+    static void release(T *object);
+
+public:
+    // A counted reference to an object of the map, like a shared_ptr
+    class handle {
+	friend class intrusive_map;
+
+	T *object = nullptr;
+
+	// REQUIRES: the reference count of object was incremented
+	explicit handle(T *object);
+
+    public:
+	handle() = default;
+	handle(const handle &other);
+	handle(handle &&other);
+	handle &operator=(handle other);
+	~handle();
+
+	T *get() const { return object; }
+	T &operator*() const { return *object; }
+	T *operator->() const { return object; }
+	explicit operator bool() const { return object != nullptr; }
+
+	bool operator==(const handle &other) const
+	{
+	    return object == other.object;
+	}
+	bool operator!=(const handle &other) const
+	{
+	    return object != other.object;
+	}
+    };
+
+    // REQUIRES: nshards > 0
+    explicit intrusive_map(unsigned int nshards = 16);
+
+    // REQUIRES: no handles to objects of the map exist
+    ~intrusive_map();
+
+    template <typename K, typename... Args>
+    handle lookup(const K &k, Args &&... args);
+
+    // EFFECTS: returns the number of entries (that is, of live objects)
+    std::size_t size() const;
+};
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::handle::handle(T *object_)
+    : object(object_)
+{
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::handle::handle(const handle &other)
+    : object(other.object)
+{
+    if (object) {
+	// The count is at least one (other's), so no lock is needed
+	object->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::handle::handle(handle &&other)
+    : object(other.object)
+{
+    other.object = nullptr;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+typename intrusive_map<T, Key, Hash, Equal>::handle &
+intrusive_map<T, Key, Hash, Equal>::handle::operator=(handle other)
+{
+    std::swap(object, other.object);
+    return *this;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::handle::~handle()
+{
+    if (object) {
+	release(object);
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+template <typename K>
+std::size_t intrusive_map<T, Key, Hash, Equal>::probe(const shard &s,
+						      std::size_t h,
+						      const K &k)
+// REQUIRES: s.m is held, s has at least one unused slot
+//
+// EFFECTS: returns the slot holding k, or else the unused slot where k
+//          belongs
+{
+    std::size_t mask = s.slots.size() - 1;
+
+    for (std::size_t i = h & mask; ; i = (i + 1) & mask) {
+	const slot &x = s.slots[i];
+	if (!x.object || (x.object->hash == h && Equal()(x.key, k))) {
+	    return i;
+	}
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void intrusive_map<T, Key, Hash, Equal>::erase(shard &s, const T *object)
+// REQUIRES: s.m is held, object is in s
+//
+// MODIFIES: s
+//
+// EFFECTS: empties the slot of object, shifting later slots of the
+//          same probe run back as dynamic_map::erase does
+{
+    std::size_t mask = s.slots.size() - 1;
+    std::size_t i = object->hash & mask;
+
+    while (s.slots[i].object != object) {
+	i = (i + 1) & mask;
+    }
+
+    for (std::size_t j = (i + 1) & mask; s.slots[j].object;
+	 j = (j + 1) & mask) {
+	std::size_t home = s.slots[j].object->hash & mask;
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    s.slots[i] = std::move(s.slots[j]);
+	    i = j;
+	}
+    }
+
+    s.slots[i] = slot();
+    s.count--;
+
+    if (s.slots.size() > min_slots && s.count * 8 < s.slots.size()) {
+	rebuild(s, 0);
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void intrusive_map<T, Key, Hash, Equal>::rebuild(shard &s,
+						 std::size_t extra)
+// REQUIRES: s.m is held
+//
+// MODIFIES: s
+//
+// EFFECTS: rehashes the entries of s into a table that is at most half
+//          full even after extra more insertions
+{
+    std::size_t size = min_slots;
+    while ((s.count + extra) * 2 > size) {
+	size *= 2;
+    }
+
+    std::vector<slot> old(size);
+    old.swap(s.slots);
+
+    std::size_t mask = size - 1;
+    for (slot &x : old) {
+	if (x.object) {
+	    std::size_t i = x.object->hash & mask;
+	    while (s.slots[i].object) {
+		i = (i + 1) & mask;
+	    }
+	    s.slots[i] = std::move(x);
+	}
+    }
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void *intrusive_map<T, Key, Hash, Equal>::allocate(shard &s)
+// REQUIRES: s.m is held
+//
+// EFFECTS: returns storage for one T from the pool of s
+{
+    if (s.free_list.empty()) {
+	s.chunks.emplace_back(new storage[chunk_objects]);
+	for (std::size_t i = chunk_objects; i > 0; i--) {
+	    s.free_list.push_back(&s.chunks.back()[i - 1]);
+	}
+    }
+
+    void *p = s.free_list.back();
+    s.free_list.pop_back();
+    return p;
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+void intrusive_map<T, Key, Hash, Equal>::release(T *object)
+// EFFECTS: drops one reference to object, destroying it and erasing its
+//          entry if it was the last
+{
+    // Not the last reference: just count down
+    unsigned int refs = object->refs.load(std::memory_order_relaxed);
+    while (refs > 1) {
+	if (object->refs.compare_exchange_weak(refs, refs - 1,
+					       std::memory_order_release,
+					       std::memory_order_relaxed)) {
+	    return;
+	}
+    }
+
+    // Possibly the last: decide under the shard lock, since a lookup may
+    // be adding a reference right now
+    shard &s = *static_cast<shard *>(object->owner);
+    {
+	std::lock_guard<std::mutex> lock(s.m);
+	if (object->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+	    return;
+	}
+	erase(s, object);
+    }
+
+    // Outside the shard lock: the destructor may use the map itself
+    object->~T();
+
+    std::lock_guard<std::mutex> lock(s.m);
+    s.free_list.push_back(object);
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::intrusive_map(unsigned int nshards_)
+    : shards(new shard[nshards_ ? nshards_ : 1]),
+      nshards(nshards_ ? nshards_ : 1)
+{
+    static_assert(std::is_base_of<intrusive_map_object, T>::value,
+		  "intrusive_map objects must derive from intrusive_map_object");
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+intrusive_map<T, Key, Hash, Equal>::~intrusive_map()
+{
+    assert(size() == 0);
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+template <typename K, typename... Args>
+typename intrusive_map<T, Key, Hash, Equal>::handle
+intrusive_map<T, Key, Hash, Equal>::lookup(const K &k, Args &&... args)
+// MODIFIES: this
+//
+// EFFECTS: Returns a handle to the object currently assigned to the
+//          key k, as dynamic_map::lookup does.  Is thread-safe
+{
+    std::size_t                  h = dynamic_map_mix(Hash()(k));
+    shard                       &s = shards[(h >> 32) % nshards];
+    std::lock_guard<std::mutex>  lock(s.m);
+
+    if ((s.count + 1) * 4 > s.slots.size() * 3) {
+	rebuild(s, 1);
+    }
+
+    slot &x = s.slots[probe(s, h, k)];
+
+    if (x.object) {
+	// Alive: the count cannot drop to zero while we hold the lock
+	x.object->refs.fetch_add(1, std::memory_order_relaxed);
+	return handle(x.object);
+    }
+
+    // A new object, holding the caller's reference
+    x.key = Key(k);
+
+    void *p = allocate(s);
+    T    *object;
+    try {
+	object = new (p) T(std::forward<Args>(args)...);
+    } catch (...) {
+	s.free_list.push_back(p);
+	throw;
+    }
+
+    object->refs.store(1, std::memory_order_relaxed);
+    object->owner = &s;
+    object->hash = h;
+
+    x.object = object;
+    s.count++;
+
+    return handle(object);
+}
+
+template <typename T, typename Key, typename Hash, typename Equal>
+std::size_t intrusive_map<T, Key, Hash, Equal>::size() const
+{
+    std::size_t total = 0;
+
+    for (unsigned int i = 0; i < nshards; i++) {
+	std::lock_guard<std::mutex> lock(shards[i].m);
+	total += shards[i].count;
+    }
+    return total;
+}
+
+#endif /* _INTRUSIVE_MAP_H_ */
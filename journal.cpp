@@ -0,0 +1,374 @@
+#include "journal.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// The first block of the journal region; the groups follow it
+struct log_header {
+    char      magic[8];
+    uint64_t  sequence;                    // of the first group
+};
+
+// Home block numbers in a descriptor block
+const unsigned int log_pointers =
+    (FS_BLOCKSIZE - 8 - sizeof(uint64_t) - sizeof(uint32_t))
+    / sizeof(uint32_t);
+
+struct log_descriptor {
+    char      magic[8];
+    uint64_t  sequence;                    // of this group
+    uint32_t  count;                       // blocks that follow
+    uint32_t  blocks[log_pointers];        // their home blocks
+};
+
+struct log_commit {
+    char      magic[8];
+    uint64_t  sequence;
+    uint64_t  checksum;                    // of the descriptor and blocks
+};
+
+static_assert(sizeof(log_descriptor) <= FS_BLOCKSIZE,
+	      "a descriptor must fit in a block");
+
+const char header_magic[8] = "fs482jh";
+const char descriptor_magic[8] = "fs482jd";
+const char commit_magic[8] = "fs482jc";
+
+// FNV-1a over a run of blocks
+uint64_t checksum(uint64_t h, const void *buf, std::size_t bytes)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(buf);
+    for (std::size_t i = 0; i < bytes; i++) {
+	h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+const uint64_t checksum_start = 14695981039346656037ull;
+
+} // namespace
+
+void journal::transaction::write(unsigned int block, const void *buf)
+{
+    auto it = std::find(blocks.begin(), blocks.end(), block);
+    std::size_t i = it - blocks.begin();
+
+    if (it == blocks.end()) {
+	blocks.push_back(block);
+	data.resize(blocks.size() * FS_BLOCKSIZE);
+    }
+    memcpy(&data[i * FS_BLOCKSIZE], buf, FS_BLOCKSIZE);
+}
+
+unsigned int journal::transaction::size() const
+{
+    return blocks.size();
+}
+
+double journal::stats_t::transactions_per_group() const
+{
+    return groups ? static_cast<double>(transactions) / groups : 0.0;
+}
+
+journal::journal(block_device &disk_)
+    : disk(disk_), geom(disk_.geometry()),
+      max_group(std::min(log_pointers, geom.journal_blocks - 3))
+{
+    assert(geom.journal_blocks >= 4 && geom.block_size == FS_BLOCKSIZE);
+    recover();
+}
+
+journal::~journal()
+{
+    checkpoint();
+}
+
+void journal::recover()
+// EFFECTS: replays the complete groups of the journal, in order, and
+//          empties it
+{
+    char buf[FS_BLOCKSIZE];
+    disk.readblock(geom.journal_start, buf);
+
+    log_header h;
+    memcpy(&h, buf, sizeof(h));
+    sequence = 1;
+
+    // A group counts only if it is the next one in sequence and its
+    // commit block matches it, so a group torn by a crash, and whatever
+    // is left from before the last checkpoint, end the replay.
+    if (!memcmp(h.magic, header_magic, sizeof(h.magic))) {
+	std::vector<char> data;
+
+	sequence = h.sequence;
+	while (head + 3 <= geom.journal_blocks) {
+	    char descriptor[FS_BLOCKSIZE];
+	    disk.readblock(geom.journal_start + head, descriptor);
+
+	    log_descriptor d;
+	    memcpy(&d, descriptor, sizeof(d));
+	    if (memcmp(d.magic, descriptor_magic, sizeof(d.magic)) ||
+		d.sequence != sequence || d.count == 0 ||
+		d.count > max_group ||
+		head + d.count + 2 > geom.journal_blocks) {
+		break;
+	    }
+
+	    data.resize(d.count * FS_BLOCKSIZE);
+	    for (unsigned int i = 0; i < d.count; i++) {
+		disk.readblock(geom.journal_start + head + 1 + i,
+			       &data[i * FS_BLOCKSIZE]);
+	    }
+
+	    log_commit c;
+	    disk.readblock(geom.journal_start + head + 1 + d.count, buf);
+	    memcpy(&c, buf, sizeof(c));
+	    uint64_t sum = checksum(checksum(checksum_start, descriptor,
+					     FS_BLOCKSIZE),
+				    data.data(), data.size());
+	    if (memcmp(c.magic, commit_magic, sizeof(c.magic)) ||
+		c.sequence != sequence || c.checksum != sum) {
+		break;
+	    }
+
+	    for (unsigned int i = 0; i < d.count; i++) {
+		std::unique_ptr<char[]> &slot = committed[d.blocks[i]];
+		if (!slot) {
+		    slot.reset(new char[FS_BLOCKSIZE]);
+		}
+		memcpy(slot.get(), &data[i * FS_BLOCKSIZE], FS_BLOCKSIZE);
+	    }
+
+	    sequence++;
+	    head += d.count + 2;
+	    counters.recovered++;
+	}
+    }
+
+    std::unique_lock<std::mutex> lock(m);
+    write_home(lock);
+}
+
+void journal::write_home(std::unique_lock<std::mutex> &lock)
+// REQUIRES: lock holds m, and this thread set writing (or it is the
+//           constructor)
+//
+// EFFECTS: writes the committed blocks to their home blocks, then
+//          empties the journal.  m is released while writing.
+{
+    std::vector<unsigned int>  blocks;
+    std::vector<const void *>  bufs;
+
+    for (auto &c : committed) {
+	blocks.push_back(c.first);
+	bufs.push_back(c.second.get());
+    }
+
+    // Nobody else changes committed while writing is set, so it can be
+    // read without m
+    char buf[FS_BLOCKSIZE];
+    memset(buf, 0, sizeof(buf));
+    log_header h;
+    memcpy(h.magic, header_magic, sizeof(h.magic));
+    h.sequence = sequence;
+    memcpy(buf, &h, sizeof(h));
+
+    lock.unlock();
+
+    disk.writeblocks(blocks.data(), bufs.data(), blocks.size());
+
+    // Only once every block is home may the header move past the groups
+    // that hold them
+    disk.writeblock(geom.journal_start, buf);
+
+    lock.lock();
+    committed.clear();
+    head = 1;
+    counters.checkpoints++;
+}
+
+void journal::write_group(std::unique_lock<std::mutex> &lock,
+			  const std::vector<pending *> &group,
+			  unsigned int nblocks)
+// REQUIRES: lock holds m, this thread set writing, the group fits in
+//           the journal after head
+//
+// EFFECTS: writes the transactions of group to the journal as one
+//          group, and marks them done.  m is released while writing.
+{
+    uint64_t      seq = sequence;
+    unsigned int  at = geom.journal_start + head;
+
+    lock.unlock();
+
+    char           descriptor[FS_BLOCKSIZE], commit_block[FS_BLOCKSIZE];
+    log_descriptor d;
+    log_commit     c;
+
+    memset(&d, 0, sizeof(d));
+    memcpy(d.magic, descriptor_magic, sizeof(d.magic));
+    d.sequence = seq;
+    d.count = nblocks;
+
+    std::vector<unsigned int>  blocks;
+    std::vector<const void *>  bufs;
+
+    blocks.push_back(at);
+    bufs.push_back(descriptor);
+    for (pending *p : group) {
+	for (unsigned int i = 0; i < p->t->size(); i++) {
+	    d.blocks[blocks.size() - 1] = p->t->blocks[i];
+	    blocks.push_back(at + blocks.size());
+	    bufs.push_back(&p->t->data[i * FS_BLOCKSIZE]);
+	}
+    }
+    assert(blocks.size() == nblocks + 1);
+
+    memset(descriptor, 0, sizeof(descriptor));
+    memcpy(descriptor, &d, sizeof(d));
+
+    uint64_t sum = checksum(checksum_start, descriptor, FS_BLOCKSIZE);
+    for (unsigned int i = 1; i <= nblocks; i++) {
+	sum = checksum(sum, bufs[i], FS_BLOCKSIZE);
+    }
+
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magic, commit_magic, sizeof(c.magic));
+    c.sequence = seq;
+    c.checksum = sum;
+    memset(commit_block, 0, sizeof(commit_block));
+    memcpy(commit_block, &c, sizeof(c));
+    blocks.push_back(at + nblocks + 1);
+    bufs.push_back(commit_block);
+
+    // The checksum makes the group whole or absent after a crash, so all
+    // of it can go out in one request in any order
+    disk.writeblocks(blocks.data(), bufs.data(), blocks.size());
+
+    lock.lock();
+    for (pending *p : group) {
+	for (unsigned int i = 0; i < p->t->size(); i++) {
+	    std::unique_ptr<char[]> &slot = committed[p->t->blocks[i]];
+	    if (!slot) {
+		slot.reset(new char[FS_BLOCKSIZE]);
+	    }
+	    memcpy(slot.get(), &p->t->data[i * FS_BLOCKSIZE], FS_BLOCKSIZE);
+	}
+	p->done = true;
+    }
+
+    sequence++;
+    head += nblocks + 2;
+    counters.groups++;
+    counters.transactions += group.size();
+    counters.log_blocks += nblocks + 2;
+}
+
+void journal::commit(const transaction &t)
+{
+    assert(t.size() <= max_group);
+    for (unsigned int b : t.blocks) {
+	assert(b < geom.journal_start ||
+	       b >= geom.journal_start + geom.journal_blocks);
+	assert(b < geom.disk_blocks && b != geom.superblock());
+    }
+    if (!t.size()) {
+	return;
+    }
+
+    pending p = {&t, false};
+    std::unique_lock<std::mutex> lock(m);
+    queue.push_back(&p);
+
+    // Whoever finds no group being written writes the next one, made
+    // of everything that queued up in the meantime
+    while (!p.done) {
+	if (writing) {
+	    cv.wait(lock);
+	    continue;
+	}
+	writing = true;
+
+	std::vector<pending *> group;
+	unsigned int           nblocks = 0;
+	while (!queue.empty() &&
+	       nblocks + queue.front()->t->size() <= max_group) {
+	    nblocks += queue.front()->t->size();
+	    group.push_back(queue.front());
+	    queue.pop_front();
+	}
+
+	if (head + nblocks + 2 > geom.journal_blocks) {
+	    write_home(lock);
+	}
+	write_group(lock, group, nblocks);
+
+	writing = false;
+	cv.notify_all();
+    }
+}
+
+void journal::checkpoint()
+{
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this] { return !writing; });
+
+    writing = true;
+    write_home(lock);
+    writing = false;
+    cv.notify_all();
+}
+
+unsigned int journal::max_transaction() const
+{
+    return max_group;
+}
+
+journal::stats_t journal::stats() const
+{
+    std::lock_guard<std::mutex> lock(m);
+    return counters;
+}
+
+void journal::readblock(unsigned int block, void *buf)
+{
+    {
+	std::lock_guard<std::mutex> lock(m);
+	auto it = committed.find(block);
+	if (it != committed.end()) {
+	    memcpy(buf, it->second.get(), FS_BLOCKSIZE);
+	    return;
+	}
+    }
+
+    // Not committed since the last checkpoint, so the home block is
+    // current
+    disk.readblock(block, buf);
+}
+
+void journal::writeblock(unsigned int block, const void *buf)
+{
+    transaction t;
+    t.write(block, buf);
+    commit(t);
+}
+
+void journal::writeblocks(const unsigned int *blocks,
+			  const void *const *bufs, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i += max_group) {
+	transaction t;
+	for (unsigned int j = i; j < n && j < i + max_group; j++) {
+	    t.write(blocks[j], bufs[j]);
+	}
+	commit(t);
+    }
+}
+
+fs_geometry journal::geometry() const
+{
+    return geom;
+}
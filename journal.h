@@ -0,0 +1,131 @@
+/*
+ * journal.h
+ *
+ * A write-ahead journal of metadata updates, kept in the region of the
+ * disk that formatfs -j reserves (see superblock.h).
+ *
+ * An update that spans several blocks (a file inode, the direntry block
+ * naming it and the directory inode, say) is collected in a
+ * transaction and committed at once: it reaches the disk atomically,
+ * and none of the ordering between its blocks matters any more.  A
+ * commit returns once its transaction is durable in the journal.
+ *
+ * Group commit: while one thread writes a group of transactions to the
+ * journal, the transactions committed by other threads queue up, and
+ * the next group takes all of them.  A group is one descriptor block
+ * (the home block number of each block that follows), the blocks, and
+ * a commit block with a checksum of the rest, written with a single
+ * vectored request, so N concurrent commits cost one disk request
+ * instead of N * (blocks per transaction).
+ *
+ * Committed blocks stay in memory and are only written to their home
+ * blocks at a checkpoint, which happens when the journal is full (or on
+ * checkpoint() or destruction).  Reads through the journal see them.
+ * After a crash, constructing a journal replays every complete group
+ * left in it.
+ *
+ * The journal owns the disk below it: all writes must go through it.
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "block_device.h"
+
+class journal : public block_device {
+public:
+    class transaction {
+    public:
+	// EFFECTS: adds a write of buf to block.  A later write to the
+	//          same block in this transaction replaces it.
+	void write(unsigned int block, const void *buf);
+
+	unsigned int size() const;
+
+    private:
+	friend class journal;
+
+	std::vector<unsigned int>  blocks;
+	std::vector<char>          data;       // FS_BLOCKSIZE per block
+    };
+
+    struct stats_t {
+	uint64_t transactions = 0;     // committed
+	uint64_t groups = 0;           // groups written to the journal
+	uint64_t log_blocks = 0;       // blocks written to the journal
+	uint64_t checkpoints = 0;
+	uint64_t recovered = 0;        // groups replayed at startup
+
+	double transactions_per_group() const;
+    };
+
+    // REQUIRES: disk.geometry() has a journal region and FS_BLOCKSIZE
+    //           byte blocks
+    // EFFECTS: replays the complete groups left in the journal to their
+    //          home blocks, then starts with an empty journal
+    explicit journal(block_device &disk);
+
+    // EFFECTS: checkpoints
+    ~journal();
+
+    // REQUIRES: t.size() <= max_transaction()
+    // EFFECTS: commits t as one atomic update, returning once it is
+    //          durable
+    void commit(const transaction &t);
+
+    // EFFECTS: writes every committed block to its home block and
+    //          empties the journal
+    void checkpoint();
+
+    // EFFECTS: returns the largest transaction that fits in a group
+    unsigned int max_transaction() const;
+
+    stats_t stats() const;
+
+    // Reads see every committed transaction.  Each writeblock is a
+    // transaction of its own, and writeblocks is one transaction (or
+    // several, if there are more than max_transaction() blocks).
+    void readblock(unsigned int block, void *buf) override;
+    void writeblock(unsigned int block, const void *buf) override;
+    void writeblocks(const unsigned int *blocks, const void *const *bufs,
+		     unsigned int n) override;
+
+    fs_geometry geometry() const override;
+
+private:
+    struct pending {
+	const transaction *t;
+	bool               done;
+    };
+
+    block_device       &disk;
+    const fs_geometry   geom;
+    const unsigned int  max_group;         // data blocks in a group
+
+    mutable std::mutex       m;
+    std::condition_variable  cv;
+    std::deque<pending *>    queue;        // waiting to be written
+    bool                     writing = false;  // a group or checkpoint
+					   // is being written
+    uint64_t                 sequence;     // of the next group
+    unsigned int             head = 1;     // next free journal block
+    stats_t                  counters;
+
+    // Committed blocks not yet written to their home blocks
+    std::unordered_map<unsigned int, std::unique_ptr<char[]>> committed;
+
+    void recover();
+    void write_group(std::unique_lock<std::mutex> &lock,
+		     const std::vector<pending *> &group, unsigned int nblocks);
+    void write_home(std::unique_lock<std::mutex> &lock);
+};
+
+#endif /* _JOURNAL_H_ */
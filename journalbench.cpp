@@ -0,0 +1,122 @@
+#include "journal.h"
+#include "slow_disk.h"
+#include "striped_disk.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Creates per second with N threads, where a create is the three block
+// update of ondisk.cpp (file inode, direntry block, directory inode):
+// written in order with three synchronous writeblocks, versus committed
+// as one journal transaction with group commit.  The disk is a scratch
+// image behind a slow_disk.
+//
+//     usage: journalbench [max threads] [seconds per run] [latency us]
+
+double run(block_device &disk, journal *log, unsigned int nthreads,
+	   double seconds)
+// EFFECTS: creates files from nthreads threads for the given time,
+//          through log if it is given and in order on disk otherwise,
+//          and returns creates per second
+{
+    std::atomic<bool>      stop(false);
+    std::atomic<uint64_t>  total(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([&, t] {
+	    // Each thread has a directory of its own
+	    unsigned int file = 1 + 3 * t, dirblock = file + 1, dir = file + 2;
+	    char inode[FS_BLOCKSIZE], entries[FS_BLOCKSIZE], parent[FS_BLOCKSIZE];
+	    uint64_t creates = 0;
+
+	    memset(inode, 'f', sizeof(inode));
+	    memset(entries, 'e', sizeof(entries));
+	    memset(parent, 'd', sizeof(parent));
+	    while (!stop.load(std::memory_order_relaxed)) {
+		if (log) {
+		    journal::transaction x;
+		    x.write(file, inode);
+		    x.write(dirblock, entries);
+		    x.write(dir, parent);
+		    log->commit(x);
+		} else {
+		    disk.writeblock(file, inode);
+		    disk.writeblock(dirblock, entries);
+		    disk.writeblock(dir, parent);
+		}
+		creates++;
+	    }
+	    total += creates;
+	});
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &thread : threads) {
+	thread.join();
+    }
+
+    return total / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    double       seconds = argc > 2 ? atof(argv[2]) : 0.5;
+    unsigned int latency = argc > 3 ? atoi(argv[3]) : 100;
+
+    // A zero-filled scratch image with a journal of 1024 blocks
+    std::string path = "/tmp/fs_bench." + std::to_string(getpid()) + ".disk";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    int status = ftruncate(fd, off_t(FS_DISKSIZE) * FS_BLOCKSIZE);
+    assert(status == 0);
+
+    fs_geometry g;
+    g.has_superblock = true;
+    g.journal_blocks = 1024;
+    g.journal_start = g.superblock() - g.journal_blocks;
+    write_superblock(fd, g);
+    close(fd);
+
+    striped_disk  image(path);
+    slow_disk     disk(image, latency);
+
+    {
+	journal log(disk);
+
+	std::cout << "threads  ordered creates/s  journaled creates/s"
+		  << "  speedup  transactions/group\n";
+	for (unsigned int n = 1; n <= max_threads && n * 3 < 1024; n *= 2) {
+	    journal::stats_t before = log.stats();
+	    double b = run(disk, nullptr, n, seconds);
+	    double a = run(disk, &log, n, seconds);
+	    journal::stats_t after = log.stats();
+
+	    double per_group = double(after.transactions - before.transactions)
+			       / (after.groups - before.groups);
+	    std::cout << std::setw(7) << n << std::fixed
+		      << std::setprecision(0) << std::setw(19) << b
+		      << std::setw(21) << a << std::setprecision(2)
+		      << std::setw(8) << a / b << "x" << std::setw(20)
+		      << per_group << "\n";
+	}
+
+	journal::stats_t stats = log.stats();
+	std::cout << "\n" << stats.transactions << " transactions in "
+		  << stats.groups << " groups, " << stats.log_blocks
+		  << " journal blocks written, " << stats.checkpoints
+		  << " checkpoints\n";
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
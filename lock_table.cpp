@@ -0,0 +1,139 @@
+#include "lock_table.h"
+
+#include <cassert>
+#include <stdexcept>
+
+block_lock::block_lock(lock_table &table, uint32_t block, mode_t mode)
+    : mutex(table.get(block)), blk(block), md(mode)
+{
+    if (md == exclusive) {
+	mutex->lock();
+    } else {
+	mutex->lock_shared();
+    }
+}
+
+block_lock::block_lock(block_lock &&other)
+{
+    swap(other);
+}
+
+block_lock &block_lock::operator=(block_lock &&other)
+{
+    if (owns_lock()) {
+	unlock();
+    }
+    swap(other);
+    return *this;
+}
+
+block_lock::~block_lock()
+{
+    if (owns_lock()) {
+	unlock();
+    }
+}
+
+void block_lock::swap(block_lock &other)
+{
+    std::swap(mutex, other.mutex);
+    std::swap(blk, other.blk);
+    std::swap(md, other.md);
+}
+
+void block_lock::unlock()
+{
+    assert(owns_lock());
+
+    if (md == exclusive) {
+	mutex->unlock();
+    } else {
+	mutex->unlock_shared();
+    }
+
+    // Dropping our reference lets the lock evaporate if it was the last
+    mutex = nullptr;
+}
+
+bool block_lock::owns_lock() const
+{
+    return mutex != nullptr;
+}
+
+uint32_t block_lock::block() const
+{
+    return blk;
+}
+
+block_lock::mode_t block_lock::mode() const
+{
+    return md;
+}
+
+std::shared_ptr<inode_mutex> lock_table::get(uint32_t block)
+{
+    return locks.lookup(block);
+}
+
+std::size_t lock_table::size() const
+{
+    return locks.size();
+}
+
+uint32_t lock_table::lock_path(const std::string &path, block_lock &lock,
+			       block_lock::mode_t mode,
+			       const resolver &resolve)
+// REQUIRES: path is absolute ("/" or "/a/b"), at most FS_MAXPATHNAME
+//           long
+//           lock does not hold a lock
+//           the caller holds no other inode locks
+//
+// MODIFIES: lock
+//
+// EFFECTS: returns the inode block that path names, with lock holding
+//          its lock in mode.  Throws std::runtime_error if path does
+//          not exist.
+{
+    if (path.empty() || path[0] != '/' || path.size() > FS_MAXPATHNAME
+	|| lock.owns_lock()) {
+	throw std::runtime_error("lock_path: invalid argument");
+    }
+
+    // The root is the target if there are no components; otherwise it
+    // is the first node of the chain and only needs to be shared.
+    bool       at_target = path.size() == 1;
+    block_lock read_lock(*this, 0, at_target ? mode : block_lock::shared);
+    size_t     start = 1;
+
+    // Loop invariant: read_lock holds the directory that contains the
+    // component starting at path[start].
+    while (!at_target) {
+	size_t end = path.find('/', start);
+	if (end == std::string::npos) {
+	    end = path.size();
+	}
+	if (end == start) {
+	    throw std::runtime_error("lock_path: invalid argument");
+	}
+	at_target = end == path.size();
+
+	uint32_t child = resolve(read_lock.block(),
+				 path.substr(start, end - start));
+	if (!child) {
+	    throw std::runtime_error("lock_path: no such file or directory");
+	}
+
+	// Acquire the next lock before dropping the one on the parent, so
+	// the child cannot be deleted or moved in between.
+	block_lock next_lock(*this, child,
+			     at_target ? mode : block_lock::shared);
+	read_lock.swap(next_lock);
+
+	// next_lock now holds the parent, and drops it here
+	start = end + 1;
+    }
+
+    uint32_t block = read_lock.block();
+    lock.swap(read_lock);
+    return block;
+}
@@ -0,0 +1,88 @@
+/*
+ * lock_table.h
+ *
+ * Reader-writer locks for inodes, keyed by inode block number.  A lock
+ * only exists while someone holds (or is waiting for) it: locks are
+ * dynamic_map objects, created on the first request and destroyed when
+ * the last block_lock referring to one goes away.
+ *
+ * lock_path walks a path hand-over-hand, the way lookup() in hoh.cpp
+ * walks its list: shared locks down the chain of directories, each one
+ * released only once the next is held, ending with the lock of the
+ * target held in the requested mode.
+ *
+ * The locks are instrumented_mutexes recording into fs_stats, so the
+ * stats dump shows how often they were contended and for how long.
+ */
+
+#ifndef _LOCK_TABLE_H_
+#define _LOCK_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+
+#include "dynamic_map.h"
+#include "fs_server.h"
+#include "instrumented_mutex.h"
+
+class lock_table;
+
+using inode_mutex = instrumented_mutex<stats_instrumentation>;
+
+// Holds the lock of one inode block, shared or exclusive.  Like
+// std::unique_lock, it may also be empty.
+class block_lock {
+public:
+    enum mode_t { shared, exclusive };
+
+    block_lock() = default;
+
+    // EFFECTS: blocks until the lock of block is held in mode
+    block_lock(lock_table &table, uint32_t block, mode_t mode);
+
+    block_lock(block_lock &&other);
+    block_lock &operator=(block_lock &&other);
+    ~block_lock();
+
+    void swap(block_lock &other);
+
+    // REQUIRES: owns_lock()
+    void unlock();
+
+    bool owns_lock() const;
+    uint32_t block() const;
+    mode_t mode() const;
+
+private:
+    std::shared_ptr<inode_mutex>        mutex;
+    uint32_t                            blk = 0;
+    mode_t                              md = shared;
+};
+
+class lock_table {
+public:
+    // Reads the directory at parent and returns the inode block of name
+    // in it, or 0 if there is none
+    using resolver = std::function<uint32_t(uint32_t parent,
+					    const std::string &name)>;
+
+    // EFFECTS: returns the lock of block, creating it if nobody else
+    //          refers to it
+    std::shared_ptr<inode_mutex> get(uint32_t block);
+
+    uint32_t lock_path(const std::string &path, block_lock &lock,
+		       block_lock::mode_t mode, const resolver &resolve);
+
+    // EFFECTS: returns the number of locks that exist, i.e. that some
+    //          block_lock holds or waits for
+    std::size_t size() const;
+
+private:
+    // Thread safe on its own, so get() needs no lock of the table's
+    dynamic_map<inode_mutex, uint32_t>           locks;
+};
+
+#endif /* _LOCK_TABLE_H_ */
@@ -0,0 +1,103 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "fs_log.h"
+#include "fs_server.h"
+#include "fs_stats.h"
+
+// Compare logging through std::cout under one global mutex (the way
+// cout_lock from fs_server.h is used) with FS_LOG, at 1, 2, 4, ...
+// threads each logging a line per "request".  Both write to a scratch
+// file, /tmp/fs_logbench.<pid>.log, which is removed afterwards.  The
+// waits for the lock are recorded in fs_stats and printed at the end;
+// kill -USR1 <pid> prints them while it runs.
+//
+//     usage: logbench [max threads] [lines per thread]
+
+static std::mutex print_lock;           // stands in for cout_lock
+
+template <typename Log>
+double run(unsigned int nthreads, unsigned int lines, Log log)
+// EFFECTS: returns lines per second of nthreads threads each calling
+//          log(thread, i) for i < lines
+{
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([=] {
+	    for (unsigned int i = 0; i < lines; i++) {
+		log(t, i);
+	    }
+	});
+    }
+    for (auto &thread : threads) {
+	thread.join();
+    }
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+
+    return nthreads * lines / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    unsigned int lines = argc > 2 ? atoi(argv[2]) : 100000;
+    std::string  path = "/tmp/fs_logbench." + std::to_string(getpid()) +
+			".log";
+
+    fs_stats::dump_on_signal();
+
+    if (!fs_log::open(path.c_str())) {
+	perror(path.c_str());
+	return 1;
+    }
+
+    std::ofstream file(path, std::ios::app);
+    std::streambuf *terminal = std::cout.rdbuf();
+
+    std::cout << "threads   cout_lock lines/s   FS_LOG lines/s  speedup\n";
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	std::cout.rdbuf(file.rdbuf());
+	double locked = run(n, lines, [](unsigned int t, unsigned int i) {
+	    stats_lock_guard<std::mutex> lock(print_lock, time_cout_lock_wait);
+	    std::cout << "thread " << t << ": request " << i
+		      << " done, block " << i * 7 % FS_DISKSIZE << "\n";
+	});
+	std::cout.flush();
+	std::cout.rdbuf(terminal);
+
+	// Includes the time to drain what is still queued
+	auto start = std::chrono::steady_clock::now();
+	double async = run(n, lines, [](unsigned int t, unsigned int i) {
+	    FS_LOG(log_info) << "thread " << t << ": request " << i
+			     << " done, block " << i * 7 % FS_DISKSIZE;
+	});
+	fs_log::flush();
+	std::chrono::duration<double> elapsed =
+	    std::chrono::steady_clock::now() - start;
+	double drained = n * lines / elapsed.count();
+
+	std::cout << std::setw(7) << n << std::fixed << std::setprecision(0)
+		  << std::setw(20) << locked << std::setw(17) << async
+		  << std::setprecision(2) << std::setw(8) << async / locked
+		  << "   (" << std::setprecision(0) << drained
+		  << " lines/s drained)\n";
+    }
+
+    std::cout << "\n";
+    fs_stats::dump(std::cout);
+
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dynamic_map.h"
+#include "fs_param.h"
+#include "intrusive_map.h"
+
+// Compare dynamic_map and intrusive_map with the original std::map
+// version from dynmap.cpp on three single-threaded workloads over names
+// like directory entries:
+//
+//     hit (string)   the object is alive, key is a std::string
+//     hit (char[])   the same, key is a char[FS_MAXFILENAME + 1]
+//     churn          every lookup creates the object and drops it
+//
+//     usage: mapbench [names] [lookups per run]
+
+// The original dynamic map: two tree walks on a miss, and entries are
+// never removed
+template <typename T>
+class legacy_map {
+    std::map<std::string, std::weak_ptr<T>>  map;
+
+public:
+    std::shared_ptr<T> lookup(const std::string &k)
+    {
+	std::weak_ptr<T> tentative = map[k];
+	std::shared_ptr<T> result = tentative.lock();
+
+	if (!result) {
+	    result = std::make_shared<T>();
+	    map[k] = result;
+	}
+	return result;
+    }
+
+    std::size_t size() const
+    {
+	return map.size();
+    }
+};
+
+// What the maps hold; its contents do not matter
+struct object : intrusive_map_object {
+    unsigned int value = 0;
+};
+
+struct names {
+    std::vector<std::string>  strings;
+    std::vector<char>         arrays;          // FS_MAXFILENAME + 1 each
+
+    const char *array(std::size_t i) const
+    {
+	return &arrays[i * (FS_MAXFILENAME + 1)];
+    }
+};
+
+template <typename Map, typename Lookup>
+double run(Map &map, unsigned long lookups, Lookup lookup)
+// EFFECTS: returns lookups per second of lookups calls to lookup(map)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < lookups; i++) {
+	lookup(map);
+    }
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+    return lookups / elapsed.count();
+}
+
+template <typename Map>
+void bench(const char *label, const names &n, unsigned long lookups)
+{
+    using handle = decltype(std::declval<Map &>().lookup(std::string()));
+
+    Map                                  map;
+    std::vector<handle>                  pinned;
+    std::mt19937                         rng(1);
+    std::uniform_int_distribution<std::size_t> pick(0, n.strings.size() - 1);
+
+    for (const std::string &s : n.strings) {
+	pinned.push_back(map.lookup(s));
+    }
+
+    double by_string = run(map, lookups, [&](Map &m) {
+	m.lookup(n.strings[pick(rng)]);
+    });
+    double by_array = run(map, lookups, [&](Map &m) {
+	m.lookup(n.array(pick(rng)));
+    });
+
+    // Drop the objects, so every lookup creates a new one
+    pinned.clear();
+    double churn = run(map, lookups, [&](Map &m) {
+	m.lookup(n.strings[pick(rng)]);
+    });
+
+    std::cout << std::left << std::setw(12) << label << std::right
+	      << std::fixed << std::setprecision(0)
+	      << std::setw(15) << by_string << std::setw(15) << by_array
+	      << std::setw(15) << churn << std::setw(12) << map.size()
+	      << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::size_t   count = argc > 1 ? atoi(argv[1]) : 10000;
+    unsigned long lookups = argc > 2 ? atol(argv[2]) : 1000000;
+    names         n;
+
+    if (count == 0) {
+	count = 1;
+    }
+
+    n.arrays.resize(count * (FS_MAXFILENAME + 1));
+    for (std::size_t i = 0; i < count; i++) {
+	char *name = &n.arrays[i * (FS_MAXFILENAME + 1)];
+	snprintf(name, FS_MAXFILENAME + 1, "file%06zu.txt", i);
+	n.strings.push_back(name);
+    }
+
+    std::cout << count << " names, " << lookups << " lookups per run"
+	      << " (lookups/s; entries left after churn)\n"
+	      << "map          hit (string)  hit (char[])"
+	      << "          churn     entries\n";
+
+    bench<legacy_map<object>>("std::map", n, lookups);
+    bench<dynamic_map<object>>("dynamic_map", n, lookups);
+    bench<intrusive_map<object>>("intrusive", n, lookups);
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "mmap_disk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+mmap_disk::mmap_disk(const std::string &path, unsigned int nstripes)
+    : striped_disk(path, nstripes),
+      bytes(size_t(geom.disk_blocks) * geom.block_size)
+{
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(p != MAP_FAILED);
+    base = static_cast<char *>(p);
+}
+
+mmap_disk::~mmap_disk()
+{
+    munmap(base, bytes);
+}
+
+char *mmap_disk::address(unsigned int block)
+{
+    assert(block < geom.disk_blocks);
+    return base + size_t(block) * geom.block_size;
+}
+
+void mmap_disk::readblock(unsigned int block, void *buf)
+{
+    std::shared_lock<std::shared_mutex> lock(stripe_for(block).m);
+    memcpy(buf, address(block), geom.block_size);
+}
+
+void mmap_disk::writeblock(unsigned int block, const void *buf)
+{
+    std::unique_lock<std::shared_mutex> lock(stripe_for(block).m);
+    memcpy(address(block), buf, geom.block_size);
+}
+
+mmap_disk::view<fs_inode> mmap_disk::inode(unsigned int block)
+{
+    static_assert(sizeof(fs_inode) <= FS_BLOCKSIZE, "inode exceeds a block");
+    assert(geom.block_size == FS_BLOCKSIZE);
+    return block_view<fs_inode>(block);
+}
+
+mmap_disk::view<fs_direntry> mmap_disk::direntries(unsigned int block)
+{
+    assert(geom.block_size == FS_BLOCKSIZE);
+    return block_view<fs_direntry>(block);
+}
+
+mmap_disk::view<packed_dirblock>
+mmap_disk::packed_direntries(unsigned int block)
+{
+    assert(geom.block_size == FS_BLOCKSIZE);
+    return block_view<packed_dirblock>(block);
+}
+
+void mmap_disk::sync()
+{
+    // Writes through the mapping and through the file descriptor (the
+    // vectored calls inherited from striped_disk) both have to go out.
+    int status = msync(base, bytes, MS_SYNC);
+    assert(status == 0);
+    status = fdatasync(fd);
+    assert(status == 0);
+}
+
+void mmap_disk::sync(unsigned int block)
+{
+    // msync needs a page-aligned start address
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t(block) * geom.block_size) / page * page;
+    size_t end = std::min(bytes, size_t(block + 1) * geom.block_size);
+
+    assert(block < geom.disk_blocks);
+    int status = msync(base + start, end - start, MS_SYNC);
+    assert(status == 0);
+}
@@ -0,0 +1,84 @@
+/*
+ * mmap_disk.h
+ *
+ * A block_device that maps the whole disk image into memory.  readblock
+ * and writeblock are plain memcpys, and read-only views hand out
+ * pointers straight into the mapping so that metadata can be examined
+ * without any copy or system call.
+ *
+ * Writes reach the page cache immediately but are only durable after
+ * sync().
+ */
+
+#ifndef _MMAP_DISK_H_
+#define _MMAP_DISK_H_
+
+#include <cassert>
+
+#include "packed_dir.h"
+#include "striped_disk.h"
+
+class mmap_disk : public striped_disk {
+public:
+    // A read-only view of one block.  Holds the block's stripe lock
+    // shared for as long as it lives, so the block cannot change (and
+    // writes to it wait) while it is being examined.  Views must not
+    // outlive the disk they came from.
+    template <typename T>
+    class view {
+	std::shared_lock<std::shared_mutex> lock;
+	const T *ptr;
+
+	friend class mmap_disk;
+	view(std::shared_mutex &m, const char *p)
+	    : lock(m), ptr(reinterpret_cast<const T *>(p)) {}
+
+    public:
+	view(view &&) = default;
+	view &operator=(view &&) = default;
+
+	const T *get() const { return ptr; }
+	const T *operator->() const { return ptr; }
+	const T &operator*() const { return *ptr; }
+	const T &operator[](unsigned int i) const { return ptr[i]; }
+    };
+
+    // REQUIRES: as for striped_disk
+    // EFFECTS: opens and maps the disk image.  Asserts on failure.
+    explicit mmap_disk(const std::string &path = fs_disk_path(),
+		       unsigned int nstripes = 64);
+    ~mmap_disk();
+
+    void readblock(unsigned int block, void *buf) override;
+    void writeblock(unsigned int block, const void *buf) override;
+
+    // REQUIRES: sizeof(T) <= geometry().block_size
+    // EFFECTS: returns a view of block as a T, e.g. an
+    //          fs_format<BlockSize>::inode
+    template <typename T>
+    view<T> block_view(unsigned int block)
+    {
+	assert(sizeof(T) <= geom.block_size);
+	return view<T>(stripe_for(block).m, address(block));
+    }
+
+    // REQUIRES: geometry().block_size == FS_BLOCKSIZE
+    // EFFECTS: returns a view of block as an inode / direntry block /
+    //          packed direntry block
+    view<fs_inode> inode(unsigned int block);
+    view<fs_direntry> direntries(unsigned int block);
+    view<packed_dirblock> packed_direntries(unsigned int block);
+
+    // EFFECTS: makes all completed writes durable (or only those to
+    //          block)
+    void sync();
+    void sync(unsigned int block);
+
+private:
+    char *base;
+    size_t bytes;                       // mapped
+
+    char *address(unsigned int block);
+};
+
+#endif /* _MMAP_DISK_H_ */
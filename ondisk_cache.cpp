@@ -0,0 +1,82 @@
+#include "block_cache.h"
+
+#include <cassert>
+#include <cstring>
+
+// The same file creation as ondisk.cpp, but through a write-back block
+// cache.  The flush points keep the on-disk ordering of ondisk.cpp:
+// file inode, then direntry block, then root inode.  The creation is
+// timed as a request would be by the server, and the stats are printed
+// at the end.
+
+void create(block_cache &cache)
+{
+    FS_COUNT(count_requests);
+    FS_TIME(time_request);
+
+    fs_inode root_inode;
+
+    // Read the root inode of the (assumed to be) empty file system.
+    // The second read is served from the cache.
+    {
+	FS_TIME(time_request_lookup);
+	cache.readblock(0, &root_inode);
+	cache.readblock(0, &root_inode);
+    }
+
+    assert(root_inode.type == 'd');
+    assert(root_inode.owner[0] == '\0');
+    assert(root_inode.size == 0);
+
+    FS_TIME(time_request_update);
+
+    // Create an empty file at block 1
+    fs_inode file_inode;
+
+    file_inode.type = 'f';
+    strcpy(file_inode.owner, "bnoble");
+    file_inode.size = 0;
+
+    cache.writeblock(1, &file_inode);
+
+    // The file inode must be on disk before a direntry refers to it
+    cache.flush();
+
+    fs_direntry   root_dirblock[FS_DIRENTRIES];
+
+    for (unsigned int i = 0; i<FS_DIRENTRIES; i++) {
+	root_dirblock[i].inode_block = 0; // unused
+    }
+
+    strcpy(root_dirblock[0].name, "aFile");
+    root_dirblock[0].inode_block = 1;
+
+    cache.writeblock(2, root_dirblock);
+
+    // The direntry block must be on disk before the root inode names it
+    cache.flush();
+
+    root_inode.size = 1;
+    root_inode.blocks[0] = 2;
+
+    cache.writeblock(0, &root_inode);
+    cache.flush();
+}
+
+int main()
+{
+    fs_server_device   disk;
+    block_cache        cache(disk, 64);
+
+    create(cache);
+
+    block_cache::stats_t stats = cache.stats();
+    std::cout << "cache: " << cache.capacity() << " of " << FS_DISKSIZE
+	      << " blocks, " << stats.hits << " hits, " << stats.misses
+	      << " misses (hit rate " << stats.hit_rate() << "), "
+	      << stats.evictions << " evictions, " << stats.writebacks
+	      << " writebacks\n";
+    fs_stats::dump(std::cout);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "packed_dir.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+// Bytes an entry called name takes, not counting its hash
+unsigned int record_bytes(std::string_view name)
+{
+    return sizeof(uint32_t) + 1 + name.size();
+}
+
+} // namespace
+
+packed_dirblock::packed_dirblock()
+{
+    clear();
+}
+
+void packed_dirblock::clear()
+{
+    // The whole block, so nothing left over reaches the disk
+    memset(this, 0, sizeof(*this));
+}
+
+unsigned int packed_dirblock::count() const
+{
+    return nentries;
+}
+
+uint8_t packed_dirblock::hash(std::string_view name)
+{
+    // FNV-1a, which does not change between builds the way std::hash
+    // may
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+	h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24);
+}
+
+uint8_t *packed_dirblock::top()
+{
+    return reinterpret_cast<uint8_t *>(data + sizeof(data));
+}
+
+const uint8_t *packed_dirblock::top() const
+{
+    return reinterpret_cast<const uint8_t *>(data + sizeof(data));
+}
+
+bool packed_dirblock::fits(std::string_view name) const
+{
+    return end + nentries + record_bytes(name) + 1 <= sizeof(data);
+}
+
+uint32_t packed_dirblock::find(std::string_view name) const
+{
+    const uint8_t  h = hash(name);
+    const uint8_t *hashes = top() - nentries;
+
+    // Look for h in eight hashes at a time: a byte of x is zero where
+    // the hash matches, and the expression below is non-zero if and
+    // only if some byte of x is zero
+    const uint64_t ones = 0x0101010101010101ull;
+    bool  candidate = false;
+    unsigned int i = 0;
+
+    for (; i + 8 <= nentries && !candidate; i += 8) {
+	uint64_t x;
+	memcpy(&x, hashes + i, sizeof(x));
+	x ^= ones * h;
+	candidate = ((x - ones) & ~x & (ones << 7)) != 0;
+    }
+    for (; i < nentries && !candidate; i++) {
+	candidate = hashes[i] == h;
+    }
+    if (!candidate) {
+	return 0;
+    }
+
+    // Compare only the names whose hash matches
+    unsigned int at = 0;
+    for (unsigned int j = 0; j < nentries; j++) {
+	uint8_t length = data[at + sizeof(uint32_t)];
+
+	if (top()[-1 - int(j)] == h && length == name.size() &&
+	    !memcmp(data + at + sizeof(uint32_t) + 1, name.data(), length)) {
+	    uint32_t inode_block;
+	    memcpy(&inode_block, data + at, sizeof(inode_block));
+	    return inode_block;
+	}
+	at += sizeof(uint32_t) + 1 + length;
+    }
+    return 0;
+}
+
+bool packed_dirblock::insert(std::string_view name, uint32_t inode_block)
+{
+    assert(!name.empty() && name.size() <= FS_MAXFILENAME);
+    assert(inode_block);
+
+    if (!fits(name)) {
+	return false;
+    }
+
+    uint8_t length = name.size();
+    memcpy(data + end, &inode_block, sizeof(inode_block));
+    data[end + sizeof(inode_block)] = length;
+    memcpy(data + end + sizeof(inode_block) + 1, name.data(), length);
+
+    top()[-1 - int(nentries)] = hash(name);
+    end += record_bytes(name);
+    nentries++;
+    return true;
+}
+
+bool packed_dirblock::erase(std::string_view name)
+{
+    unsigned int at = 0;
+
+    for (unsigned int i = 0; i < nentries; i++) {
+	uint8_t length = data[at + sizeof(uint32_t)];
+	unsigned int bytes = sizeof(uint32_t) + 1 + length;
+
+	if (length == name.size() &&
+	    !memcmp(data + at + sizeof(uint32_t) + 1, name.data(), length)) {
+	    // Close the gaps in the entries and in the hashes
+	    memmove(data + at, data + at + bytes, end - at - bytes);
+	    memset(data + end - bytes, 0, bytes);
+
+	    uint8_t *hashes = top() - nentries;
+	    memmove(hashes + 1, hashes, nentries - 1 - i);
+	    hashes[0] = 0;
+
+	    end -= bytes;
+	    nentries--;
+	    return true;
+	}
+	at += bytes;
+    }
+    return false;
+}
+
+unsigned int packed_dirblock::unpack(fs_direntry *entries) const
+{
+    unsigned int n = 0;
+
+    for_each([&](std::string_view name, uint32_t inode_block) {
+	fs_direntry &d = entries[n++];
+	memset(&d, 0, sizeof(d));
+	memcpy(d.name, name.data(), name.size());
+	d.inode_block = inode_block;
+    });
+    return n;
+}
@@ -0,0 +1,116 @@
+/*
+ * packed_dir.h
+ *
+ * A second directory block format with variable-length names.  A plain
+ * direntry block has room for FS_DIRENTRIES names of up to
+ * FS_MAXFILENAME characters whatever their length; a packed block
+ * stores each entry as
+ *
+ *     inode_block (4 bytes), name length (1 byte), name (no null)
+ *
+ * one after the other from the front of the block, so an 8 character
+ * name takes 13 bytes and a block holds 30-70 entries instead of 8.
+ * Scanning a directory and missing in it read that much fewer blocks.
+ *
+ * Each entry also has a one byte hash of its name, kept in an array
+ * that grows down from the end of the block.  A lookup compares the
+ * hash against eight entries at a time, and only reads the names whose
+ * hash matches, so a miss rarely touches a name at all.
+ *
+ * The entries of a block are packed: erasing one moves the ones after
+ * it down, so an entry has no fixed position within its block.
+ *
+ * A directory whose blocks are packed has type FS_PACKED_DIRECTORY in
+ * a plain fs_inode.  convertfs -p packs the directories of an image.
+ */
+
+#ifndef _PACKED_DIR_H_
+#define _PACKED_DIR_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "block_device.h"
+
+static const char FS_PACKED_DIRECTORY = 'p';
+
+/*
+ * Most entries in one packed block (if all names are one character)
+ */
+static const unsigned int FS_PACKED_DIRENTRIES =
+    (FS_BLOCKSIZE - 2 * sizeof(uint16_t)) / (sizeof(uint32_t) + 3);
+
+inline bool is_packed_directory(const fs_inode &inode)
+{
+    return inode.type == FS_PACKED_DIRECTORY;
+}
+
+class packed_dirblock {
+public:
+    // EFFECTS: creates an empty block
+    packed_dirblock();
+
+    // EFFECTS: removes every entry
+    void clear();
+
+    unsigned int count() const;
+
+    // EFFECTS: returns true if there is room for an entry called name
+    bool fits(std::string_view name) const;
+
+    // EFFECTS: returns the inode block of name, or 0 if it is not in the
+    //          block
+    uint32_t find(std::string_view name) const;
+
+    // REQUIRES: 0 < name.size() <= FS_MAXFILENAME, name is not in the
+    //           block, inode_block != 0
+    // EFFECTS: adds name, returning false if there is no room for it
+    bool insert(std::string_view name, uint32_t inode_block);
+
+    // EFFECTS: removes name, returning false if it was not there
+    bool erase(std::string_view name);
+
+    // EFFECTS: calls f(name, inode_block) for every entry, in order
+    template <typename F>
+    void for_each(F f) const;
+
+    // REQUIRES: entries has room for count() entries
+    // EFFECTS: copies the entries out as plain direntries, returning
+    //          how many there were
+    unsigned int unpack(fs_direntry *entries) const;
+
+private:
+    // The header, the entries from after it up to end, free space, then
+    // the hashes of entries 0, 1, ... going down from the end of data
+    uint16_t  nentries;
+    uint16_t  end;
+    char      data[FS_BLOCKSIZE - 2 * sizeof(uint16_t)];
+
+    static uint8_t hash(std::string_view name);
+
+    // The hash of entry i is at top()[-1 - i]
+    uint8_t *top();
+    const uint8_t *top() const;
+};
+
+static_assert(sizeof(packed_dirblock) == FS_BLOCKSIZE,
+	      "a packed directory block must be a block");
+
+template <typename F>
+void packed_dirblock::for_each(F f) const
+{
+    unsigned int at = 0;
+
+    for (unsigned int i = 0; i < nentries; i++) {
+	uint32_t inode_block;
+	memcpy(&inode_block, data + at, sizeof(inode_block));
+	uint8_t length = data[at + sizeof(inode_block)];
+	const char *name = data + at + sizeof(inode_block) + 1;
+
+	f(std::string_view(name, length), inode_block);
+	at += sizeof(inode_block) + 1 + length;
+    }
+}
+
+#endif /* _PACKED_DIR_H_ */
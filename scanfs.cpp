@@ -0,0 +1,116 @@
+#include "free_map.h"
+#include "striped_disk.h"
+
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+// Rebuild the free block map of the file system disk with 1, 2, 4, ...
+// threads, and report how fast the tree is walked.  An image with a
+// block size other than FS_BLOCKSIZE (see formatfs) is walked by one
+// thread through its own fs_format.
+//
+//     usage: scanfs [max threads] [path]
+//
+// path defaults to the disk of libfs_server.o, /tmp/fs_tmp.$USER.disk.
+
+template <unsigned int BlockSize>
+tree_walk::stats_t scan(block_device &disk, free_map &free_blocks)
+// REQUIRES: disk has BlockSize byte blocks in the plain format,
+//           free_blocks is all free and the size of disk
+// MODIFIES: free_blocks
+// EFFECTS: marks the blocks used by the file system on disk as used, as
+//          free_map::build does, and returns the statistics of the walk
+{
+    using layout = fs_format<BlockSize>;
+
+    auto        start = std::chrono::steady_clock::now();
+    fs_geometry g = disk.geometry();
+    assert(g.block_size == BlockSize);
+
+    if (g.has_superblock) {
+	free_blocks.reserve(g.superblock());
+    }
+    for (unsigned int i = 0; i < g.journal_blocks; i++) {
+	free_blocks.reserve(g.journal_start + i);
+    }
+
+    std::unique_ptr<typename layout::inode> inode(new typename layout::inode);
+    std::vector<fs_direntry>   entries(layout::direntries);
+    std::vector<unsigned int>  pending = {0};
+    tree_walk::stats_t         stats;
+
+    while (!pending.empty()) {
+	unsigned int block = pending.back();
+	pending.pop_back();
+
+	disk.readblock(block, inode.get());
+	stats.blocks++;
+	free_blocks.reserve(block);
+	assert(inode->type == 'f' || inode->type == 'd');
+	assert(inode->size <= layout::max_file_blocks);
+
+	for (unsigned int i = 0; i < inode->size; i++) {
+	    free_blocks.reserve(inode->blocks[i]);
+	    if (inode->type != 'd') {
+		continue;
+	    }
+
+	    disk.readblock(inode->blocks[i], entries.data());
+	    stats.blocks++;
+	    for (const fs_direntry &e : entries) {
+		if (e.inode_block) {
+		    pending.push_back(e.inode_block);
+		}
+	    }
+	}
+    }
+
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+    stats.seconds = elapsed.count();
+    return stats;
+}
+
+void report(unsigned int nthreads, const tree_walk::stats_t &stats,
+	    const free_map &free_blocks)
+{
+    std::cout << std::setw(7) << nthreads << std::setw(13) << stats.blocks
+	      << std::fixed << std::setprecision(6) << std::setw(9)
+	      << stats.seconds << std::setprecision(0) << std::setw(10)
+	      << stats.blocks_per_sec() << std::setw(9)
+	      << free_blocks.free_count() << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    striped_disk disk(argc > 2 ? argv[2] : fs_disk_path());
+    fs_geometry  g = disk.geometry();
+    free_map     free_blocks(g.disk_blocks);
+
+    std::cout << "threads  blocks read  seconds  blocks/s     free\n";
+    if (g.block_size != FS_BLOCKSIZE) {
+	tree_walk::stats_t stats;
+	switch (g.block_size) {
+	case 512:   stats = scan<512>(disk, free_blocks);   break;
+	case 1024:  stats = scan<1024>(disk, free_blocks);  break;
+	case 2048:  stats = scan<2048>(disk, free_blocks);  break;
+	case 4096:  stats = scan<4096>(disk, free_blocks);  break;
+	case 8192:  stats = scan<8192>(disk, free_blocks);  break;
+	case 16384: stats = scan<16384>(disk, free_blocks); break;
+	case 32768: stats = scan<32768>(disk, free_blocks); break;
+	case 65536: stats = scan<65536>(disk, free_blocks); break;
+	}
+	report(1, stats, free_blocks);
+	return 0;
+    }
+
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	report(n, free_blocks.build(disk, n), free_blocks);
+    }
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "free_map.h"
+#include "fs_tool.h"
+#include "mmap_disk.h"
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Print the file system tree in the same form as showfs, reading every
+// inode and direntry block through zero-copy mmap_disk views.  Extent
+// inodes (see extent_inode.h) are shown as the plain inodes they
+// correspond to, so the output of an image in either format can be fed
+// back to createfs.  An inline inode (see inline_inode.h) is shown with
+// the number of bytes it holds in place of its data block, and a packed
+// directory (see packed_dir.h) like a plain one with its entries moved
+// to the front.
+
+void show(mmap_disk &disk, const std::string &path, unsigned int block)
+// EFFECTS: prints the file or directory whose inode is at block, then
+//          everything below it
+{
+    std::vector<std::pair<std::string, unsigned int>> children;
+
+    // Views of two blocks in one stripe must not be held at once (and
+    // reading an indirect block takes a stripe lock), so the inode is
+    // copied out of its view and only one direntry view is alive at a
+    // time.
+    fs_inode  inode = *disk.inode(block);
+    char      kind = inode_kind(inode);
+    inode_map map;
+    map.load(disk, inode);
+    std::vector<uint32_t> blocks = map.blocks();
+
+    std::cout << (path.empty() ? "/" : path) << " (type " << kind
+	      << ") (inode block " << block << ")\n";
+    std::cout << "\towner: " << inode.owner << "\n";
+    std::cout << "\tsize: " << inode.size << "\n";
+    std::cout << "\tdata disk blocks: ";
+    for (uint32_t b : blocks) {
+	std::cout << b << ' ';
+    }
+    std::cout << "\n";
+    if (is_inline_inode(inode)) {
+	fs_inline_inode x;
+	memcpy(&x, &inode, sizeof(x));
+	std::cout << "\tinline data: " << x.length << " bytes\n";
+    }
+
+    // The entries of a packed directory are numbered in order, as if
+    // they had been unpacked
+    unsigned int n = 0;
+    for (unsigned int i = 0; is_packed_directory(inode) && i < blocks.size();
+	 i++) {
+	mmap_disk::view<packed_dirblock> dir =
+	    disk.packed_direntries(blocks[i]);
+	dir->for_each([&](std::string_view name, uint32_t inode_block) {
+	    std::cout << "\tentry " << n++ << ": " << name
+		      << ", inode block " << inode_block << "\n";
+	    children.emplace_back(name, inode_block);
+	});
+    }
+
+    for (unsigned int i = 0; kind == 'd' && !is_packed_directory(inode) &&
+			     i < blocks.size(); i++) {
+	mmap_disk::view<fs_direntry> dir = disk.direntries(blocks[i]);
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    if (dir[j].inode_block) {
+		std::cout << "\tentry " << i * FS_DIRENTRIES + j << ": "
+			  << dir[j].name << ", inode block "
+			  << dir[j].inode_block << "\n";
+		children.emplace_back(dir[j].name, dir[j].inode_block);
+	    }
+	}
+    }
+
+    // showfs ends a directory with one blank line and a file with two
+    std::cout << (kind == 'd' ? "\n" : "\n\n");
+
+    for (auto &child : children) {
+	show(disk, path + "/" + child.first, child.second);
+    }
+}
+
+int main(int, char *argv[])
+{
+    mmap_disk disk;
+    if (!fs_blocksize_disk(disk, argv[0])) {
+	return 1;
+    }
+    free_map  free_blocks(disk.geometry().disk_blocks);
+
+    show(disk, "", 0);
+
+    free_blocks.build(disk, 4);
+    std::cout << free_blocks.free_count() << " disk blocks free\n";
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * slow_disk.h
+ *
+ * A block_device for benchmarks that serves one request at a time, each
+ * taking a fixed latency however many blocks it moves, in front of
+ * another device.  This is roughly how a real disk behaves, while the
+ * image behind it sits in the page cache.
+ */
+
+#ifndef _SLOW_DISK_H_
+#define _SLOW_DISK_H_
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "block_device.h"
+
+class slow_disk : public block_device {
+    block_device               &disk;
+    std::chrono::microseconds   latency;
+    std::mutex                  busy;
+
+    void wait()
+    {
+	std::lock_guard<std::mutex> lock(busy);
+	std::this_thread::sleep_for(latency);
+    }
+
+public:
+    slow_disk(block_device &disk_, unsigned int us)
+	: disk(disk_), latency(us) {}
+
+    fs_geometry geometry() const override
+    {
+	return disk.geometry();
+    }
+
+    void readblock(unsigned int block, void *buf) override
+    {
+	wait();
+	disk.readblock(block, buf);
+    }
+
+    void writeblock(unsigned int block, const void *buf) override
+    {
+	wait();
+	disk.writeblock(block, buf);
+    }
+
+    void readblocks(const unsigned int *blocks, void *const *bufs,
+		    unsigned int n) override
+    {
+	wait();
+	disk.readblocks(blocks, bufs, n);
+    }
+
+    void writeblocks(const unsigned int *blocks, const void *const *bufs,
+		     unsigned int n) override
+    {
+	wait();
+	disk.writeblocks(blocks, bufs, n);
+    }
+};
+
+#endif /* _SLOW_DISK_H_ */
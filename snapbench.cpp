@@ -0,0 +1,368 @@
+#include "cow_tree.h"
+#include "fs_tool.h"
+#include "striped_disk.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Copy-on-write snapshots under load: one writer creates and deletes
+// files in /snapbench, two at a time, first alone and then while reader
+// threads walk snapshots of the whole tree.  Every snapshot must show an
+// even number of files, each with its name in its data block.  At the
+// end the files are deleted and every block must be back in the free
+// map.  Runs on a scratch copy of the disk.
+//
+//     usage: snapbench [readers] [seconds per run]
+
+const unsigned int max_files = 200;
+
+// An empty block, for zero-initializing direntry blocks
+struct zero_block {
+    char data[FS_BLOCKSIZE] = {};
+};
+
+bool add_entry(cow_tree::update &u, unsigned int dir, const char *name,
+	       unsigned int inode_block)
+// EFFECTS: adds name to the directory at dir, in its first free slot or
+//          in a new direntry block.  Returns false if the disk is full.
+{
+    fs_inode inode;
+    fs_direntry entries[FS_DIRENTRIES];
+    u.read(dir, &inode);
+
+    for (unsigned int i = 0; i < inode.size; i++) {
+	u.read(inode.blocks[i], entries);
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    if (!entries[j].inode_block) {
+		strcpy(entries[j].name, name);
+		entries[j].inode_block = inode_block;
+		u.write(inode.blocks[i], entries);
+		return true;
+	    }
+	}
+    }
+
+    assert(inode.size < FS_MAXFILEBLOCKS);
+    unsigned int block = u.allocate();
+    if (!block) {
+	return false;
+    }
+    memset(entries, 0, sizeof(entries));
+    strcpy(entries[0].name, name);
+    entries[0].inode_block = inode_block;
+    u.write(block, entries);
+
+    inode.blocks[inode.size++] = block;
+    u.write(dir, &inode);
+    return true;
+}
+
+unsigned int remove_entry(cow_tree::update &u, unsigned int dir,
+			  const std::string &name)
+// EFFECTS: removes name from the directory at dir and returns its inode
+//          block
+{
+    fs_inode inode;
+    fs_direntry entries[FS_DIRENTRIES];
+    u.read(dir, &inode);
+
+    for (unsigned int i = 0; i < inode.size; i++) {
+	u.read(inode.blocks[i], entries);
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    if (entries[j].inode_block && name == entries[j].name) {
+		unsigned int block = entries[j].inode_block;
+		entries[j].inode_block = 0;
+		u.write(inode.blocks[i], entries);
+		return block;
+	    }
+	}
+    }
+    assert(false);
+    return 0;
+}
+
+unsigned int find(cow_tree::update &u, unsigned int dir, const char *name)
+// EFFECTS: returns the inode block of name in the directory at dir
+{
+    fs_inode inode;
+    fs_direntry entries[FS_DIRENTRIES];
+    u.read(dir, &inode);
+
+    for (unsigned int i = 0; i < inode.size; i++) {
+	u.read(inode.blocks[i], entries);
+	for (unsigned int j = 0; j < FS_DIRENTRIES; j++) {
+	    if (entries[j].inode_block && !strcmp(entries[j].name, name)) {
+		return entries[j].inode_block;
+	    }
+	}
+    }
+    assert(false);
+    return 0;
+}
+
+void fill(char *data, const std::string &name)
+// EFFECTS: fills a data block with copies of name
+{
+    for (unsigned int i = 0; i < FS_BLOCKSIZE; i++) {
+	data[i] = name[i % name.size()];
+    }
+}
+
+bool create(cow_tree::update &u, unsigned int dir, const std::string &name)
+// EFFECTS: creates the file name in dir, with one data block.  Returns
+//          false if the disk is full.
+{
+    unsigned int inode_block = u.allocate();
+    unsigned int data_block = u.allocate();
+    if (!inode_block || !data_block) {
+	return false;
+    }
+
+    char data[FS_BLOCKSIZE];
+    fill(data, name);
+    u.write(data_block, data);
+
+    fs_inode inode;
+    memset(&inode, 0, sizeof(inode));
+    inode.type = 'f';
+    strcpy(inode.owner, "snap");
+    inode.size = 1;
+    inode.blocks[0] = data_block;
+    u.write(inode_block, &inode);
+
+    return add_entry(u, dir, name.c_str(), inode_block);
+}
+
+void remove(cow_tree::update &u, unsigned int dir, const std::string &name)
+{
+    unsigned int inode_block = remove_entry(u, dir, name);
+    fs_inode inode;
+    u.read(inode_block, &inode);
+    u.release(inode.blocks[0]);
+    u.release(inode_block);
+}
+
+// Checks one snapshot
+class checker : public tree_walk::visitor {
+    cow_tree::snapshot &snap;
+
+public:
+    std::atomic<unsigned int>  files{0};
+    std::atomic<unsigned int>  bad{0};
+
+    explicit checker(cow_tree::snapshot &snap_) : snap(snap_) {}
+
+    void inode(const std::string &path, unsigned int block,
+	       const fs_inode &inode, const inode_map &map) override
+    {
+	if (path.compare(0, 11, "/snapbench/")) {
+	    return;
+	}
+	files++;
+
+	char data[FS_BLOCKSIZE], expect[FS_BLOCKSIZE];
+	snap.readblock(inode.blocks[0], data);
+	fill(expect, path.substr(11));
+	if (inode.type != 'f' || inode.size != 1 ||
+	    memcmp(data, expect, FS_BLOCKSIZE)) {
+	    bad++;
+	}
+    }
+};
+
+bool step(cow_tree &tree, std::vector<std::string> &files,
+	  unsigned int &serial, std::mt19937 &rng)
+// EFFECTS: creates two files or deletes two, in one update.  Returns
+//          false, changing nothing, if the disk is full.
+{
+    cow_tree::update u(tree);
+
+    // Each commit moves the directory's inode, so look it up again
+    unsigned int dir = find(u, 0, "snapbench");
+
+    if (files.size() + 2 <= max_files && (files.empty() || rng() % 2)) {
+	std::string names[2] = {"f" + std::to_string(serial),
+				"f" + std::to_string(serial + 1)};
+	if (!create(u, dir, names[0]) || !create(u, dir, names[1]) ||
+	    !u.commit()) {
+	    return false;
+	}
+	files.insert(files.end(), names, names + 2);
+	serial += 2;
+    } else {
+	for (unsigned int i = 1; i <= 2; i++) {
+	    std::swap(files[rng() % (files.size() - i + 1)],
+		      files[files.size() - i]);
+	    remove(u, dir, files[files.size() - i]);
+	}
+	if (!u.commit()) {
+	    return false;
+	}
+	files.resize(files.size() - 2);
+    }
+    return true;
+}
+
+struct run_stats {
+    uint64_t updates = 0;
+    uint64_t full = 0;                 // waits for snapshots to go
+    uint64_t walks = 0;
+    uint64_t bad = 0;
+    double   seconds = 0;
+};
+
+run_stats run(cow_tree &tree, unsigned int readers,
+	      double seconds, std::vector<std::string> &files,
+	      unsigned int &serial)
+{
+    std::atomic<bool>      stop(false);
+    std::atomic<uint64_t>  walks(0), bad(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int i = 0; i < readers; i++) {
+	threads.emplace_back([&] {
+	    while (!stop) {
+		std::shared_ptr<cow_tree::snapshot> s = tree.current();
+		checker check(*s);
+		tree_walk(*s, 1).run(check);
+		bad += check.bad + check.files % 2;
+		walks++;
+	    }
+	});
+    }
+
+    run_stats r;
+    std::mt19937 rng(readers + 1);
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0);
+
+    while (elapsed.count() < seconds) {
+	if (step(tree, files, serial, rng)) {
+	    r.updates++;
+	} else {
+	    // The readers' snapshots hold the free blocks
+	    r.full++;
+	    std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    stop = true;
+    for (auto &thread : threads) {
+	thread.join();
+    }
+    r.walks = walks;
+    r.bad = bad;
+    r.seconds = elapsed.count();
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int readers = argc > 1 ? atoi(argv[1]) : 2;
+    double       seconds = argc > 2 ? atof(argv[2]) : 2;
+
+    // A scratch copy of the disk
+    std::string path = "/tmp/fs_bench." + std::to_string(getpid()) + ".disk";
+    {
+	std::ifstream in(fs_disk_path(), std::ios::binary);
+	assert(in);
+	std::ofstream out(path, std::ios::binary);
+	out << in.rdbuf();
+    }
+
+    striped_disk  disk(path);
+    if (!fs_blocksize_disk(disk, argv[0])) {
+	unlink(path.c_str());
+	return 1;
+    }
+    free_map      free_blocks(disk.geometry().disk_blocks);
+    free_blocks.build(disk);
+    unsigned int  free_before = free_blocks.free_count();
+
+    {
+	cow_tree tree(disk, free_blocks);
+
+	// The directory the writer works in
+	{
+	    cow_tree::update u(tree);
+	    unsigned int dir = u.allocate();
+	    assert(dir);
+	    fs_inode inode;
+	    memset(&inode, 0, sizeof(inode));
+	    inode.type = 'd';
+	    strcpy(inode.owner, "snap");
+	    u.write(dir, &inode);
+	    add_entry(u, 0, "snapbench", dir);
+	    u.commit();
+	}
+
+	std::vector<std::string> files;
+	unsigned int serial = 0;
+
+	std::cout << "readers  updates/s  walks/s  disk full  inconsistent\n";
+	for (unsigned int n : {0u, readers}) {
+	    run_stats r = run(tree, n, seconds, files, serial);
+	    std::cout << std::setw(7) << n << std::fixed
+		      << std::setprecision(0) << std::setw(11)
+		      << r.updates / r.seconds << std::setw(9)
+		      << r.walks / r.seconds << std::setw(11) << r.full
+		      << std::setw(14) << r.bad
+		      << "\n";
+	}
+
+	// An old snapshot keeps its blocks; dropping it frees them
+	std::shared_ptr<cow_tree::snapshot> old = tree.current();
+	{
+	    cow_tree::update u(tree);
+	    unsigned int dir = find(u, 0, "snapbench");
+	    for (const std::string &name : files) {
+		remove(u, dir, name);
+	    }
+	    u.commit();
+	}
+	unsigned int held = free_blocks.free_count();
+	old.reset();
+	std::cout << "blocks held by a snapshot after deleting "
+		  << files.size() << " files: "
+		  << free_blocks.free_count() - held << "\n";
+	files.clear();
+
+	// Remove /snapbench and its direntry blocks
+	cow_tree::update u(tree);
+	unsigned int dir = find(u, 0, "snapbench");
+	fs_inode inode;
+	u.read(dir, &inode);
+	for (unsigned int i = 0; i < inode.size; i++) {
+	    u.release(inode.blocks[i]);
+	}
+	remove_entry(u, 0, "snapbench");
+	u.release(dir);
+	u.commit();
+    }
+
+    // With every snapshot gone, the free map must match the tree on
+    // disk again (the root directory may have kept a new direntry block)
+    free_map check(disk.geometry().disk_blocks);
+    check.build(disk);
+    unsigned int wrong = 0;
+    for (unsigned int b = 0; b < check.size(); b++) {
+	wrong += check.is_free(b) != free_blocks.is_free(b);
+    }
+    std::cout << "free blocks: " << free_before << " before, "
+	      << free_blocks.free_count() << " after, " << wrong
+	      << " not matching the disk\n";
+
+    unlink(path.c_str());
+    return 0;
+}
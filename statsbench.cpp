@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "fs_stats.h"
+
+// The cost of recording each kind of fs_stats event, per event, with 1,
+// 2, 4, ... threads recording at once.  "empty" is the loop alone; the
+// others include it.  While it runs, kill -USR1 <pid> dumps the stats
+// so far to standard error; they are printed at the end as well.
+//
+//     usage: statsbench [max threads] [events per thread]
+
+template <typename Event>
+double run(unsigned int nthreads, unsigned long events, Event event)
+// EFFECTS: returns the CPU time in ns per call of event, with nthreads
+//          threads each calling it events times
+{
+    unsigned int hardware = std::thread::hardware_concurrency();
+    unsigned int cores = std::min(nthreads, std::max(1u, hardware));
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < nthreads; t++) {
+	threads.emplace_back([&] {
+	    for (unsigned long i = 0; i < events; i++) {
+		event(i);
+	    }
+	});
+    }
+    for (auto &thread : threads) {
+	thread.join();
+    }
+
+    std::chrono::duration<double, std::nano> elapsed =
+	std::chrono::steady_clock::now() - start;
+    return elapsed.count() * cores / (double(nthreads) * events);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int  max_threads = argc > 1 ? atoi(argv[1]) : 4;
+    unsigned long events = argc > 2 ? atol(argv[2]) : 2000000;
+
+    fs_stats::dump_on_signal();
+
+    std::cout << "pid " << getpid() << ", " << events
+	      << " events per thread (ns per event"
+	      << (FS_STATS ? "" : ", FS_STATS=0") << ")\n"
+	      << "threads      empty      count     record       time"
+	      << "  lock_guard\n";
+
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+	std::mutex m;
+
+	double empty = run(n, events, [&](unsigned long i) {
+	    volatile unsigned long sink = i;
+	    (void) sink;
+	});
+	double count = run(n, events, [&](unsigned long i) {
+	    FS_COUNT(count_requests);
+	});
+	double record = run(n, events, [&](unsigned long i) {
+	    FS_RECORD(time_request, i & 0xffff);
+	});
+	double time = run(n, events, [&](unsigned long i) {
+	    FS_TIME(time_request_lookup);
+	});
+	double guard = run(n, events, [&](unsigned long i) {
+	    stats_lock_guard<std::mutex> lock(m, time_lock_wait);
+	});
+
+	std::cout << std::setw(7) << n << std::fixed << std::setprecision(1)
+		  << std::setw(11) << empty << std::setw(11) << count
+		  << std::setw(11) << record << std::setw(11) << time
+		  << std::setw(12) << guard << "\n";
+    }
+
+    std::cout << "\n";
+    fs_stats::dump(std::cout);
+    return 0;
+}
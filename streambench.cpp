@@ -0,0 +1,167 @@
+#include "file_stream.h"
+#include "inline_inode.h"
+#include "slow_disk.h"
+#include "striped_disk.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+// Throughput of reading and rewriting a file of FS_MAXFILEBLOCKS blocks
+// front to back: one readblock/writeblock per block, through a
+// file_stream (read-ahead and write-behind), and with one vectored
+// request for the whole file, which is what the device can do at best.
+// The rewrite is also done with write_file_block, which must accept
+// overwrites of a full file.
+// Then reads in random order, where read-ahead must stay out of the
+// way.  The disk is a scratch image behind a slow_disk.
+//
+//     usage: streambench [latency us] [max window] [passes]
+
+double measure(unsigned int passes, const std::function<void()> &pass)
+// EFFECTS: runs pass passes times and returns MB/s for the file
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < passes; i++) {
+	pass();
+    }
+    std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+
+    return double(passes) * FS_MAXFILEBLOCKS * FS_BLOCKSIZE
+	   / elapsed.count() / (1 << 20);
+}
+
+void report(const char *what, double mbps, double requests)
+{
+    std::cout << std::setw(28) << what << std::fixed << std::setprecision(2)
+	      << std::setw(10) << mbps << std::setprecision(1)
+	      << std::setw(16) << requests << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int latency = argc > 1 ? atoi(argv[1]) : 100;
+    unsigned int max_window = argc > 2 ? atoi(argv[2]) : 32;
+    unsigned int passes = argc > 3 ? atoi(argv[3]) : 20;
+
+    // A zero-filled scratch image of the same size as the disk
+    std::string path = "/tmp/fs_bench." + std::to_string(getpid()) + ".disk";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    int status = ftruncate(fd, off_t(FS_DISKSIZE) * FS_BLOCKSIZE);
+    assert(status == 0);
+    close(fd);
+
+    striped_disk  image(path);
+    slow_disk     disk(image, latency);
+
+    // A full file in consecutive blocks
+    fs_inode file;
+    memset(&file, 0, sizeof(file));
+    file.type = 'f';
+    file.size = FS_MAXFILEBLOCKS;
+    for (unsigned int i = 0; i < file.size; i++) {
+	file.blocks[i] = i + 1;
+    }
+
+    std::vector<char>  data(FS_MAXFILEBLOCKS * FS_BLOCKSIZE, 'x');
+    std::vector<void *> bufs(FS_MAXFILEBLOCKS);
+    for (unsigned int i = 0; i < file.size; i++) {
+	bufs[i] = &data[i * FS_BLOCKSIZE];
+    }
+    char buf[FS_BLOCKSIZE];
+
+    std::cout << "sequential, " << latency << "us per request"
+	      << "        MB/s  requests/pass\n";
+
+    report("readblock per block", measure(passes, [&] {
+	for (unsigned int i = 0; i < file.size; i++) {
+	    disk.readblock(file.blocks[i], buf);
+	}
+    }), file.size);
+
+    file_stream::stats_t total;
+    double mbps = measure(passes, [&] {
+	file_stream s(disk, file, max_window);
+	for (unsigned int i = 0; i < s.size(); i++) {
+	    s.read(i, buf);
+	}
+	total.requests += s.stats().requests;
+    });
+    report("file_stream read-ahead", mbps, double(total.requests) / passes);
+
+    report("one readblocks", measure(passes, [&] {
+	disk.readblocks(file.blocks, bufs.data(), file.size);
+    }), 1);
+
+    report("writeblock per block", measure(passes, [&] {
+	for (unsigned int i = 0; i < file.size; i++) {
+	    disk.writeblock(file.blocks[i], bufs[i]);
+	}
+    }), file.size);
+
+    total.requests = 0;
+    mbps = measure(passes, [&] {
+	file_stream s(disk, file, max_window);
+	for (unsigned int i = 0; i < s.size(); i++) {
+	    s.write(i, bufs[i]);
+	}
+	s.flush();
+	total.requests += s.stats().requests;
+    });
+    report("file_stream write-behind", mbps, double(total.requests) / passes);
+
+    // Rewriting a full file through write_file_block must not allocate
+    // and leaves the inode as it is
+    std::vector<char> rewritten(data.size(), 'y');
+    report("write_file_block per block", measure(passes, [&] {
+	for (unsigned int i = 0; i < file.size; i++) {
+	    bool ok = write_file_block(disk, 0, file, i,
+				       &rewritten[i * FS_BLOCKSIZE],
+				       [] { assert(false); return 0u; },
+				       [](unsigned int) { assert(false); });
+	    assert(ok);
+	}
+    }), file.size);
+    assert(file.size == FS_MAXFILEBLOCKS);
+    disk.readblocks(file.blocks, bufs.data(), file.size);
+    assert(data == rewritten);
+
+    std::cout << "\nrandom order\n";
+
+    std::vector<unsigned int> order(file.size);
+    for (unsigned int i = 0; i < file.size; i++) {
+	order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    report("readblock per block", measure(passes, [&] {
+	for (unsigned int i : order) {
+	    disk.readblock(file.blocks[i], buf);
+	}
+    }), file.size);
+
+    total.requests = 0;
+    total.prefetched = 0;
+    mbps = measure(passes, [&] {
+	file_stream s(disk, file, max_window);
+	for (unsigned int i : order) {
+	    s.read(i, buf);
+	}
+	total.requests += s.stats().requests;
+	total.prefetched += s.stats().prefetched;
+    });
+    report("file_stream read-ahead", mbps, double(total.requests) / passes);
+    std::cout << std::setw(28) << "blocks read ahead/pass"
+	      << std::setw(26) << double(total.prefetched) / passes << "\n";
+
+    unlink(path.c_str());
+    return 0;
+}
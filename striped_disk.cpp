@@ -0,0 +1,148 @@
+#include "striped_disk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <fcntl.h>
+#include <mutex>
+#include <numeric>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "fs_stats.h"
+
+striped_disk::striped_disk(const std::string &path, unsigned int nstripes_)
+    : nstripes(nstripes_), stripes(new stripe[nstripes_])
+{
+    assert(nstripes > 0);
+
+    fd = open(path.c_str(), O_RDWR);
+    assert(fd >= 0);
+
+    geom = fs_geometry::probe(fd);
+}
+
+striped_disk::~striped_disk()
+{
+    close(fd);
+}
+
+fs_geometry striped_disk::geometry() const
+{
+    return geom;
+}
+
+striped_disk::stripe &striped_disk::stripe_for(unsigned int block)
+{
+    return stripes[block % nstripes];
+}
+
+void striped_disk::readblock(unsigned int block, void *buf)
+{
+    assert(block < geom.disk_blocks);
+
+    FS_TIME(time_disk_read);
+    FS_COUNT(count_disk_blocks_read);
+    std::shared_lock<std::shared_mutex> lock(stripe_for(block).m);
+
+    // pread does not move the file offset, so concurrent requests need
+    // no common lock around a seek.
+    ssize_t n = pread(fd, buf, geom.block_size,
+		      off_t(block) * geom.block_size);
+    assert(n == ssize_t(geom.block_size));
+}
+
+void striped_disk::writeblock(unsigned int block, const void *buf)
+{
+    assert(block < geom.disk_blocks);
+
+    FS_TIME(time_disk_write);
+    FS_COUNT(count_disk_blocks_written);
+    std::unique_lock<std::shared_mutex> lock(stripe_for(block).m);
+
+    ssize_t n = pwrite(fd, buf, geom.block_size,
+		       off_t(block) * geom.block_size);
+    assert(n == ssize_t(geom.block_size));
+}
+
+template <typename Lock, typename Buf>
+void striped_disk::transfer(const unsigned int *blocks, Buf *const *bufs,
+			    unsigned int n, bool write)
+// REQUIRES: Lock is std::shared_lock for reads, std::unique_lock for
+//           writes
+//
+// EFFECTS: performs the n requests with one preadv/pwritev per run of
+//          adjacent block numbers, holding the stripe locks of every
+//          block involved for the duration
+{
+    // Sort the requests by block.  The sort is stable so that repeated
+    // writes of one block are issued in the caller's order.
+    std::vector<unsigned int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    if (!std::is_sorted(blocks, blocks + n)) {
+	std::stable_sort(order.begin(), order.end(),
+			 [&](unsigned int a, unsigned int b) {
+			     return blocks[a] < blocks[b];
+			 });
+    }
+
+    // Lock each stripe involved once, in increasing stripe order so that
+    // two vectored requests cannot deadlock.
+    std::vector<unsigned int> used;
+    for (unsigned int i = 0; i < n; i++) {
+	assert(blocks[i] < geom.disk_blocks);
+	used.push_back(blocks[i] % nstripes);
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    std::vector<Lock> locks;
+    locks.reserve(used.size());
+    for (unsigned int s : used) {
+	locks.emplace_back(stripes[s].m);
+    }
+
+    // Issue one system call per run of adjacent blocks
+    std::vector<iovec> iov;
+    unsigned int i = 0;
+    while (i < n) {
+	unsigned int first = blocks[order[i]];
+
+	iov.clear();
+	do {
+	    iov.push_back({const_cast<void *>(static_cast<const void *>(
+			      bufs[order[i]])), geom.block_size});
+	    i++;
+	} while (i < n && blocks[order[i]] == first + iov.size()
+		 && iov.size() < IOV_MAX);
+
+	off_t   offset = off_t(first) * geom.block_size;
+	ssize_t expect = ssize_t(iov.size()) * geom.block_size;
+	ssize_t done;
+	if (iov.size() == 1) {
+	    done = write ? pwrite(fd, iov[0].iov_base, iov[0].iov_len, offset)
+			 : pread(fd, iov[0].iov_base, iov[0].iov_len, offset);
+	} else {
+	    done = write ? pwritev(fd, iov.data(), iov.size(), offset)
+			 : preadv(fd, iov.data(), iov.size(), offset);
+	}
+	assert(done == expect);
+    }
+}
+
+void striped_disk::readblocks(const unsigned int *blocks, void *const *bufs,
+			      unsigned int n)
+{
+    FS_TIME(time_disk_read);
+    FS_COUNT_N(count_disk_blocks_read, n);
+    transfer<std::shared_lock<std::shared_mutex>>(blocks, bufs, n, false);
+}
+
+void striped_disk::writeblocks(const unsigned int *blocks,
+			       const void *const *bufs, unsigned int n)
+{
+    FS_TIME(time_disk_write);
+    FS_COUNT_N(count_disk_blocks_written, n);
+    transfer<std::unique_lock<std::shared_mutex>>(blocks, bufs, n, true);
+}
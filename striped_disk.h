@@ -0,0 +1,61 @@
+/*
+ * striped_disk.h
+ *
+ * A block_device that reads and writes a disk image file directly with
+ * pread/pwrite.  Instead of serializing every request through one mutex
+ * (as disk_readwrite in libfs_server.o does), blocks are hashed onto
+ * stripes of reader-writer locks: reads of the same block share the
+ * stripe lock, writes hold it exclusively, and requests for blocks in
+ * different stripes never wait for each other.
+ */
+
+#ifndef _STRIPED_DISK_H_
+#define _STRIPED_DISK_H_
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+
+#include "block_device.h"
+
+class striped_disk : public block_device {
+public:
+    // REQUIRES: path names a disk image, with a superblock or of
+    //           FS_DISKSIZE blocks of FS_BLOCKSIZE bytes, nstripes > 0
+    // EFFECTS: opens the disk image at path.  Asserts on failure.
+    explicit striped_disk(const std::string &path = fs_disk_path(),
+			  unsigned int nstripes = 64);
+    ~striped_disk();
+
+    fs_geometry geometry() const override;
+
+    void readblock(unsigned int block, void *buf) override;
+    void writeblock(unsigned int block, const void *buf) override;
+
+    // Sorts the requests by block number and transfers each run of
+    // adjacent blocks with a single preadv/pwritev.
+    void readblocks(const unsigned int *blocks, void *const *bufs,
+		    unsigned int n) override;
+    void writeblocks(const unsigned int *blocks, const void *const *bufs,
+		     unsigned int n) override;
+
+protected:
+    // Each lock gets its own cache line so that unrelated stripes do
+    // not contend on the same line.
+    struct alignas(64) stripe {
+	std::shared_mutex m;
+    };
+
+    int fd;
+    fs_geometry geom;
+    const unsigned int nstripes;
+    std::unique_ptr<stripe[]> stripes;
+
+    stripe &stripe_for(unsigned int block);
+
+    template <typename Lock, typename Buf>
+    void transfer(const unsigned int *blocks, Buf *const *bufs,
+		  unsigned int n, bool write);
+};
+
+#endif /* _STRIPED_DISK_H_ */
@@ -0,0 +1,58 @@
+#include "superblock.h"
+
+#include <cassert>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+fs_geometry fs_geometry::probe(int fd)
+{
+    struct stat st;
+    int status = fstat(fd, &st);
+    assert(status == 0);
+
+    // The superblock fills the last block, so for each block size it
+    // would start at a different offset.  It counts only if it agrees
+    // with the size of the image.
+    uint64_t size = st.st_size;
+    for (unsigned int b = FS_MIN_BLOCKSIZE; b <= FS_MAX_BLOCKSIZE; b *= 2) {
+	if (size < b || size % b) {
+	    continue;
+	}
+
+	fs_superblock sb;
+	ssize_t n = pread(fd, &sb, sizeof(sb), size - b);
+	if (n == ssize_t(sizeof(sb)) &&
+	    !memcmp(sb.magic, fs_superblock_magic, sizeof(sb.magic)) &&
+	    sb.version == 1 && sb.block_size == b &&
+	    uint64_t(sb.disk_blocks) * b == size) {
+	    fs_geometry g;
+	    g.block_size = b;
+	    g.disk_blocks = sb.disk_blocks;
+	    g.has_superblock = true;
+	    g.journal_start = sb.journal_start;
+	    g.journal_blocks = sb.journal_blocks;
+	    return g;
+	}
+    }
+
+    return fs_geometry();
+}
+
+void write_superblock(int fd, const fs_geometry &g)
+{
+    assert(g.has_superblock);
+
+    fs_superblock sb;
+    memset(&sb, 0, sizeof(sb));
+    memcpy(sb.magic, fs_superblock_magic, sizeof(sb.magic));
+    sb.version = 1;
+    sb.block_size = g.block_size;
+    sb.disk_blocks = g.disk_blocks;
+    sb.journal_start = g.journal_start;
+    sb.journal_blocks = g.journal_blocks;
+
+    ssize_t n = pwrite(fd, &sb, sizeof(sb),
+		       off_t(g.superblock()) * g.block_size);
+    assert(n == ssize_t(sizeof(sb)));
+}
@@ -0,0 +1,101 @@
+/*
+ * superblock.h
+ *
+ * The geometry of a disk image (block size and number of blocks),
+ * chosen when the image is formatted instead of fixed at compile time.
+ *
+ * An image made by formatfs records its geometry in a superblock, which
+ * takes up the last block of the image.  The root inode stays at block
+ * 0, so an image of FS_DISKSIZE blocks of FS_BLOCKSIZE bytes is still
+ * readable by the tools that know nothing of superblocks (a server
+ * built on libfs_server.o must not allocate the last block, though).
+ * An image without a superblock, such as one made by createfs, has the
+ * compiled-in geometry.
+ *
+ * The superblock may also reserve a region of blocks just below it for
+ * the metadata journal of journal.h.
+ *
+ * fs_format<BlockSize> gives the on-disk structures for any block size,
+ * with all their limits as compile-time constants, so code written
+ * against it runs as fast for 4 KB blocks as for 512 byte ones.
+ */
+
+#ifndef _SUPERBLOCK_H_
+#define _SUPERBLOCK_H_
+
+#include <cstdint>
+
+#include "fs_server.h"
+
+struct fs_superblock {
+    char     magic[8];                     // fs_superblock_magic
+    uint32_t version;                      // 1
+    uint32_t block_size;                   // in bytes, a power of two
+    uint32_t disk_blocks;                  // including the superblock
+    uint32_t journal_start;                // first block of the journal
+    uint32_t journal_blocks;               // 0 if there is none
+};
+
+static const char fs_superblock_magic[8] = "fs482sb";
+
+/*
+ * Smallest and largest block sizes supported
+ */
+static const unsigned int FS_MIN_BLOCKSIZE = 512;
+static const unsigned int FS_MAX_BLOCKSIZE = 65536;
+
+struct fs_geometry {
+    unsigned int  block_size = FS_BLOCKSIZE;
+    unsigned int  disk_blocks = FS_DISKSIZE;
+    bool          has_superblock = false;
+    unsigned int  journal_start = 0;
+    unsigned int  journal_blocks = 0;
+
+    // REQUIRES: has_superblock
+    unsigned int superblock() const { return disk_blocks - 1; }
+
+    // EFFECTS: returns the geometry recorded in the superblock of the
+    //          image open as fd, or the compiled-in geometry if it has
+    //          none
+    static fs_geometry probe(int fd);
+};
+
+// REQUIRES: g.has_superblock, fd is open for writing on an image of
+//           g.disk_blocks blocks of g.block_size bytes
+// EFFECTS: writes the superblock for g.  Asserts on failure.
+void write_superblock(int fd, const fs_geometry &g);
+
+template <unsigned int BlockSize>
+struct fs_format {
+    static_assert(BlockSize >= FS_MIN_BLOCKSIZE &&
+		  BlockSize <= FS_MAX_BLOCKSIZE &&
+		  (BlockSize & (BlockSize - 1)) == 0,
+		  "unsupported block size");
+
+    static const unsigned int block_size = BlockSize;
+
+    // Data blocks of an inode, so that an inode is exactly one block
+    static const unsigned int max_file_blocks =
+	(BlockSize - (FS_MAXUSERNAME + 2) - sizeof(uint32_t))
+	/ sizeof(uint32_t);
+
+    // Direntries in one block
+    static const unsigned int direntries = BlockSize / sizeof(fs_direntry);
+
+    struct inode {
+	char type;                         // file ('f') or directory ('d')
+	char owner[FS_MAXUSERNAME + 1];
+	uint32_t size;                     // in blocks
+	uint32_t blocks[max_file_blocks];
+    };
+
+    static_assert(sizeof(inode) == BlockSize, "an inode must be a block");
+};
+
+// The compiled-in format is the one of fs_server.h
+static_assert(fs_format<FS_BLOCKSIZE>::max_file_blocks == FS_MAXFILEBLOCKS &&
+	      fs_format<FS_BLOCKSIZE>::direntries == FS_DIRENTRIES &&
+	      sizeof(fs_format<FS_BLOCKSIZE>::inode) == sizeof(fs_inode),
+	      "fs_format does not match fs_server.h");
+
+#endif /* _SUPERBLOCK_H_ */
@@ -0,0 +1,217 @@
+#include "tree_walk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct task {
+    std::string   path;
+    unsigned int  block;               // inode or direntry block
+    bool          is_dirblock;
+    unsigned int  index;               // position in the parent's blocks
+    bool          packed;              // a packed direntry block
+    bool          prefetched;          // inode already read into inode
+    fs_inode      inode;
+};
+
+// A worker's own tasks.  The owner works from the back (depth first,
+// which keeps the deque short); thieves take from the front, where the
+// tasks closest to the root (and so the largest) are.
+struct alignas(64) task_queue {
+    std::mutex       m;
+    std::deque<task> tasks;
+};
+
+class walker {
+    block_device               &disk;
+    tree_walk::visitor         &visit;
+    std::vector<task_queue>     queues;
+    std::atomic<uint64_t>       pending;   // tasks queued or running
+    std::atomic<uint64_t>       blocks;
+
+    void push(unsigned int self, task &&t);
+    bool pop(unsigned int self, task &t);
+    void process(unsigned int self, task &t);
+
+public:
+    walker(block_device &disk, tree_walk::visitor &visit, unsigned int n);
+
+    void work(unsigned int self);
+    uint64_t blocks_read() const { return blocks; }
+};
+
+walker::walker(block_device &disk_, tree_walk::visitor &visit_,
+	       unsigned int n)
+    : disk(disk_), visit(visit_), queues(n), pending(1), blocks(0)
+{
+    task root;
+    root.block = 0;
+    root.is_dirblock = false;
+    root.index = 0;
+    root.packed = false;
+    root.prefetched = false;
+    queues[0].tasks.push_back(std::move(root));
+}
+
+void walker::push(unsigned int self, task &&t)
+{
+    pending++;
+    std::lock_guard<std::mutex> lock(queues[self].m);
+    queues[self].tasks.push_back(std::move(t));
+}
+
+bool walker::pop(unsigned int self, task &t)
+// EFFECTS: takes a task from our own queue, or else steals one from
+//          another worker.  Returns false if there was none to be had.
+{
+    for (unsigned int i = 0; i < queues.size(); i++) {
+	task_queue &q = queues[(self + i) % queues.size()];
+	std::lock_guard<std::mutex> lock(q.m);
+
+	if (!q.tasks.empty()) {
+	    if (i == 0) {
+		t = std::move(q.tasks.back());
+		q.tasks.pop_back();
+	    } else {
+		t = std::move(q.tasks.front());
+		q.tasks.pop_front();
+	    }
+	    return true;
+	}
+    }
+    return false;
+}
+
+void walker::process(unsigned int self, task &t)
+{
+    if (!t.is_dirblock) {
+	if (!t.prefetched) {
+	    disk.readblock(t.block, &t.inode);
+	    blocks++;
+	}
+
+	inode_map map;
+	map.load(disk, t.inode);
+	blocks += map.meta.size();
+
+	visit.inode(t.path, t.block, t.inode, map);
+
+	if (inode_kind(t.inode) != 'd') {
+	    return;
+	}
+
+	// Fan out one task per direntry block
+	std::vector<uint32_t> data = map.blocks();
+	for (unsigned int i = 0; i < data.size(); i++) {
+	    task d;
+	    d.path = t.path;
+	    d.block = data[i];
+	    d.is_dirblock = true;
+	    d.index = i;
+	    d.packed = is_packed_directory(t.inode);
+	    d.prefetched = false;
+	    push(self, std::move(d));
+	}
+	return;
+    }
+
+    fs_direntry   entries[std::max(FS_DIRENTRIES, FS_PACKED_DIRENTRIES)];
+    unsigned int  n = FS_DIRENTRIES;
+
+    if (t.packed) {
+	packed_dirblock packed;
+	disk.readblock(t.block, &packed);
+	n = packed.unpack(entries);
+    } else {
+	disk.readblock(t.block, entries);
+    }
+    blocks++;
+    visit.dirblock(t.path, t.index, t.block, entries, n);
+
+    // Prefetch the inodes of all the children in one batch
+    std::vector<task>          children;
+    std::vector<unsigned int>  child_blocks;
+    std::vector<void *>        bufs;
+
+    children.reserve(n);
+    for (unsigned int j = 0; j < n; j++) {
+	if (entries[j].inode_block) {
+	    children.emplace_back();
+	    task &c = children.back();
+	    c.path = t.path + "/" + entries[j].name;
+	    c.block = entries[j].inode_block;
+	    c.is_dirblock = false;
+	    c.index = 0;
+	    c.packed = false;
+	    c.prefetched = true;
+	    child_blocks.push_back(c.block);
+	}
+    }
+    for (task &c : children) {
+	bufs.push_back(&c.inode);
+    }
+
+    disk.readblocks(child_blocks.data(), bufs.data(), child_blocks.size());
+    blocks += child_blocks.size();
+
+    for (task &c : children) {
+	push(self, std::move(c));
+    }
+}
+
+void walker::work(unsigned int self)
+{
+    task t;
+
+    while (pending) {
+	if (pop(self, t)) {
+	    process(self, t);
+	    pending--;
+	} else {
+	    // Someone else is still working and may produce more tasks
+	    std::this_thread::yield();
+	}
+    }
+}
+
+} // namespace
+
+double tree_walk::stats_t::blocks_per_sec() const
+{
+    return seconds > 0 ? blocks / seconds : 0;
+}
+
+tree_walk::tree_walk(block_device &disk_, unsigned int nthreads_)
+    : disk(disk_), nthreads(nthreads_ ? nthreads_ : 1)
+{
+    assert(disk.geometry().block_size == FS_BLOCKSIZE);
+}
+
+tree_walk::stats_t tree_walk::run(visitor &visit)
+{
+    auto    start = std::chrono::steady_clock::now();
+    walker  w(disk, visit, nthreads);
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < nthreads; i++) {
+	threads.emplace_back(&walker::work, &w, i);
+    }
+    w.work(0);
+    for (auto &thread : threads) {
+	thread.join();
+    }
+
+    stats_t stats;
+    stats.blocks = w.blocks_read();
+    stats.seconds = std::chrono::duration<double>(
+	std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,72 @@
+/*
+ * tree_walk.h
+ *
+ * A parallel walk of the whole file system tree, starting from the root
+ * inode at block 0.
+ *
+ * The work is split into tasks: reading an inode, and reading one
+ * direntry block of a directory.  Every data block of a directory
+ * becomes its own task, and all the child inodes
+ * named by a direntry block are fetched together with one vectored
+ * readblocks, so there are many requests in flight at once.  Each
+ * worker thread keeps its own task deque and steals from the others
+ * when it runs dry.
+ *
+ * Inodes may be in either format (see extent_inode.h); the indirect
+ * blocks of extent inodes are read along with the inode.  The blocks of
+ * packed directories (see packed_dir.h) are handed to the visitor as
+ * plain direntries.
+ */
+
+#ifndef _TREE_WALK_H_
+#define _TREE_WALK_H_
+
+#include <cstdint>
+#include <string>
+
+#include "block_device.h"
+#include "extent_inode.h"
+
+class tree_walk {
+public:
+    // Callbacks for the walk.  They are called concurrently from the
+    // worker threads, in no particular order (a child may be visited
+    // before the direntry block of its parent).
+    class visitor {
+    public:
+	virtual ~visitor() = default;
+
+	// path is "" for the root, otherwise "/a/b".  map holds the
+	// data blocks of the inode and any indirect blocks.
+	virtual void inode(const std::string &path, unsigned int block,
+			   const fs_inode &inode, const inode_map &map) {}
+
+	// entries are the n direntries of the block at position index of
+	// directory path: FS_DIRENTRIES of them, some unused, for a
+	// plain directory, and the used ones only for a packed one
+	virtual void dirblock(const std::string &path, unsigned int index,
+			      unsigned int block, const fs_direntry *entries,
+			      unsigned int n) {}
+    };
+
+    struct stats_t {
+	uint64_t blocks = 0;           // inode, indirect and direntry
+				       // blocks read
+	double   seconds = 0;
+
+	double blocks_per_sec() const;
+    };
+
+    // REQUIRES: nthreads > 0, disk has FS_BLOCKSIZE byte blocks
+    tree_walk(block_device &disk, unsigned int nthreads);
+
+    // EFFECTS: visits every inode and direntry block of the tree, and
+    //          returns once all of them have been visited
+    stats_t run(visitor &visit);
+
+private:
+    block_device        &disk;
+    const unsigned int   nthreads;
+};
+
+#endif /* _TREE_WALK_H_ */